@@ -0,0 +1,115 @@
+#pragma once
+#ifndef FLICTOOL_BATCH_H
+#define FLICTOOL_BATCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Flic.h"
+
+/**
+ * What a batch job does when its output already exists.
+ */
+enum class OverwritePolicy {
+	Skip,
+	Overwrite,
+	Fail
+};
+
+struct BatchJob {
+	bool compiling;
+	std::string input;
+	std::string output;
+};
+
+enum class BatchStatus {
+	Done,
+	Skipped,
+	Failed
+};
+
+struct BatchResult {
+	BatchStatus status;
+	double seconds;
+	std::string note;
+};
+
+struct BatchOptions {
+	/**
+	 * The number of jobs to run at the same time. 0 means one per hardware thread.
+	 */
+	uint32_t jobs = 0;
+
+	/**
+	 * What to do with jobs whose output already exists.
+	 */
+	OverwritePolicy overwrite = OverwritePolicy::Skip;
+
+	/**
+	 * Settings for the compile jobs. The number of threads is chosen by the batch.
+	 */
+	CompileOptions compileOptions;
+
+	/**
+	 * Settings for the decompile jobs. The number of threads is chosen by the batch.
+	 */
+	DecompileOptions decompileOptions;
+};
+
+/**
+ * Runs many compile and decompile jobs in a single process. The jobs are
+ * shared out to a fixed pool of threads, and a summary of every job is
+ * printed once all of them have finished.
+ */
+class Batch {
+public:
+	/**
+	 * Adds the jobs listed in a manifest file. Every line holds an input path, optionally followed by a tab and an
+	 * output path. Relative paths are relative to the manifest, and empty lines and lines starting with # are ignored.
+	 * \param path the path of the manifest file
+	 * \returns whether the manifest could be read
+	 */
+	bool readManifest(const std::string &path);
+
+	/**
+	 * Adds a compile job for every folder of frames and a decompile job for every FLH file found in a directory tree.
+	 * Folders of frames are compiled next to themselves, and FLH files are decompiled into a folder named after them.
+	 * When an FLH file and a folder of frames share a name, only the folder is compiled.
+	 * \param root the directory to search
+	 * \returns whether the directory could be searched
+	 */
+	bool scan(const std::string &root);
+
+	/**
+	 * Adds a job, compiling if the input is a directory and decompiling otherwise.
+	 * \param input the input path of the job
+	 * \param output the output path of the job, or an empty string to use the default for the input
+	 */
+	void add(const std::string &input, const std::string &output);
+
+	/**
+	 * \returns the jobs added so far
+	 */
+	const std::vector<BatchJob> &jobs() const;
+
+	/**
+	 * Runs all jobs and prints a summary of them.
+	 * \param options settings controlling how the jobs are run
+	 * \returns whether none of the jobs failed
+	 */
+	bool run(const BatchOptions &options);
+private:
+	/**
+	 * Runs a single job after checking its input and output.
+	 * \param job the job to run
+	 * \param options settings controlling how the job is run
+	 * \param threads the number of threads the job may use
+	 * \returns the outcome of the job
+	 */
+	BatchResult runJob(const BatchJob &job, const BatchOptions &options, uint32_t threads);
+
+	std::vector<BatchJob> jobs_;
+};
+
+#endif // FLICTOOL_BATCH_H
\ No newline at end of file
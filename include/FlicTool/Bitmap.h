@@ -6,6 +6,8 @@
 #include <memory>
 #include <string>
 
+class Stats;
+
 #pragma pack(push, 1)
 struct BitmapFileHeader {
 	char magic[2];
@@ -61,6 +63,16 @@ public:
 	 */
 	Bitmap(uint8_t *pixels, int width, int height, int bpp);
 
+	/**
+	 * Creates a bitmap sharing the specified pixel data.
+	 * See \code create \endcode for more info.
+	 * \param pixels the pixel data of the bitmap
+	 * \param width the desired width of the bitmap
+	 * \param height the desired height of the bitmap
+	 * \param bpp the desired bit depth of the bitmap
+	 */
+	Bitmap(const std::shared_ptr<uint8_t> &pixels, int width, int height, int bpp);
+
 	/**
 	 * Creates a bitmap from the specified data and values.
 	 * See \code create \endcode for more info.
@@ -72,10 +84,23 @@ public:
 	void create(uint8_t *pixels, int width, int height, int bpp);
 
 	/**
-	 * Loads a bitmap from the specified file.
+	 * Creates a bitmap sharing the specified pixel data. The pixel data is
+	 * not copied, so it must not be modified while the bitmap is in use.
+	 * \param pixels the pixel data of the bitmap
+	 * \param width the desired width of the bitmap
+	 * \param height the desired height of the bitmap
+	 * \param bpp the desired bit depth of the bitmap
+	 */
+	void create(const std::shared_ptr<uint8_t> &pixels, int width, int height, int bpp);
+
+	/**
+	 * Loads a bitmap from the specified file. Pixels of any other layout than 16-bit 5-5-5 are converted to it. 16-bit
+	 * 5-5-5 pixels without padding between lines aren't copied at all, the bitmap keeps the file mapped instead.
 	 * \param path the path of the bitmap file to load
+	 * \param dither whether to convert pixels with an ordered dither instead of rounding them to the nearest color
+	 * \param stats where to record how long loading and converting the pixels takes, or nullptr
 	 */
-	bool load(const std::string &path);
+	bool load(const std::string &path, bool dither = false, Stats *stats = nullptr);
 
 	/**
 	 * Saves the bitmap to the specified file.
@@ -98,9 +123,18 @@ public:
 	 */
 	const uint32_t height() const;
 private:
-	uint8_t *downsamplePixels(uint8_t *original, uint32_t width, uint32_t height, uint32_t bpp, uint32_t *bitMask);
-	
-	int round(float n);
+	/**
+	 * Converts pixels of the specified layout to 16-bit 5-5-5 pixels.
+	 * \param original the pixels to convert
+	 * \param width the width of the bitmap
+	 * \param height the height of the bitmap
+	 * \param pitch the distance in bytes from the start of one line of the original pixels to the next
+	 * \param bpp the number of bits per pixel of the original pixels
+	 * \param bitMask the bit masks of the blue, green, red and alpha channels
+	 * \param dither whether to convert pixels with an ordered dither instead of rounding them to the nearest color
+	 * \returns the converted pixels, allocated with new[]
+	 */
+	uint8_t *downsamplePixels(const uint8_t *original, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp, const uint32_t *bitMask, bool dither);
 
 	std::shared_ptr<uint8_t> pixels_;
 	BitmapFileHeader header_;
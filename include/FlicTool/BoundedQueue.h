@@ -0,0 +1,77 @@
+#pragma once
+#ifndef FLICTOOL_BOUNDEDQUEUE_H
+#define FLICTOOL_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * A thread-safe FIFO queue holding at most a fixed number of elements.
+ * Producers block while the queue is full, which provides back-pressure
+ * between the stages of a pipeline.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+	/**
+	 * Creates an empty queue.
+	 * \param capacity the maximum number of elements the queue can hold
+	 */
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false) {
+	}
+
+	/**
+	 * Appends an element to the queue, waiting for space if it is full.
+	 * \param value the element to append
+	 * \returns false if the queue has been closed, in which case the element is discarded
+	 */
+	bool push(T value) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notFull_.wait(lock, [this]() { return closed_ || queue_.size() < capacity_; });
+		if (closed_) {
+			return false;
+		}
+		queue_.push_back(std::move(value));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Removes the first element of the queue, waiting for one if it is empty.
+	 * \param value receives the removed element
+	 * \returns false if the queue has been closed and no elements remain
+	 */
+	bool pop(T &value) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		notEmpty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+		if (queue_.empty()) {
+			return false;
+		}
+		value = std::move(queue_.front());
+		queue_.pop_front();
+		notFull_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Closes the queue. Pending and future pushes fail, while pops keep
+	 * returning the remaining elements until the queue is empty.
+	 */
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		notEmpty_.notify_all();
+		notFull_.notify_all();
+	}
+private:
+	std::deque<T> queue_;
+	size_t capacity_;
+	bool closed_;
+	std::mutex mutex_;
+	std::condition_variable notEmpty_;
+	std::condition_variable notFull_;
+};
+
+#endif // FLICTOOL_BOUNDEDQUEUE_H
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef FLICTOOL_BYTECURSOR_H
+#define FLICTOOL_BYTECURSOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * A bounds-checked read position in a block of memory.
+ * Reading past the end of the block doesn't read anything and marks the
+ * cursor as failed, so that a whole sequence of reads can be checked at once.
+ */
+class ByteCursor {
+public:
+	/**
+	 * Creates a cursor at the start of the specified block of memory.
+	 * \param data pointer to the first byte of the block
+	 * \param size the size of the block in bytes
+	 */
+	ByteCursor(const uint8_t *data, size_t size) : data_(data), size_(size), position_(0), failed_(false) {
+	}
+
+	/**
+	 * Reads a value and advances past it.
+	 * \param value receives the value read, or is left untouched if there aren't enough bytes left
+	 * \returns whether the value could be read
+	 */
+	template <typename T>
+	bool read(T &value) {
+		const uint8_t *p = take(sizeof(T));
+		if (!p) {
+			return false;
+		}
+		memcpy(&value, p, sizeof(T));
+		return true;
+	}
+
+	/**
+	 * Advances past the specified number of bytes without copying them.
+	 * \param n the number of bytes
+	 * \returns a pointer to the first of the bytes, or nullptr if there aren't enough bytes left
+	 */
+	const uint8_t *take(size_t n) {
+		if (failed_ || n > size_ - position_) {
+			failed_ = true;
+			return nullptr;
+		}
+		const uint8_t *p = data_ + position_;
+		position_ += n;
+		return p;
+	}
+
+	/**
+	 * Splits off the specified number of bytes as a cursor of their own and advances past them.
+	 * \param n the number of bytes
+	 * \returns a cursor over the bytes, which has already failed if there weren't enough bytes left
+	 */
+	ByteCursor sub(size_t n) {
+		const uint8_t *p = take(n);
+		ByteCursor cursor(p, p ? n : 0);
+		cursor.failed_ = !p;
+		return cursor;
+	}
+
+	/**
+	 * \returns the number of bytes read so far
+	 */
+	size_t position() const {
+		return position_;
+	}
+
+	/**
+	 * \returns the number of bytes left to read
+	 */
+	size_t remaining() const {
+		return size_ - position_;
+	}
+
+	/**
+	 * \returns whether a read has gone past the end of the block
+	 */
+	bool failed() const {
+		return failed_;
+	}
+private:
+	const uint8_t *data_;
+	size_t size_;
+	size_t position_;
+	bool failed_;
+};
+
+#endif // FLICTOOL_BYTECURSOR_H
\ No newline at end of file
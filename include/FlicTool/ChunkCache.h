@@ -0,0 +1,66 @@
+#pragma once
+#ifndef FLICTOOL_CHUNKCACHE_H
+#define FLICTOOL_CHUNKCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A 128-bit key identifying the contents of a cached frame.
+ */
+struct CacheKey {
+	uint64_t high;
+	uint64_t low;
+
+	/**
+	 * \returns the key as 32 hexadecimal digits
+	 */
+	std::string name() const;
+};
+
+/**
+ * A directory of encoded frames, named by a key made from everything that
+ * went into encoding them. Since a key is taken to never refer to different
+ * contents, entries never need to be invalidated, and any number of threads
+ * and processes can share the same directory. Entries are never removed
+ * either, so the directory keeps growing until it is deleted.
+ */
+class ChunkCache {
+public:
+	/**
+	 * Default constructor.
+	 */
+	ChunkCache();
+
+	/**
+	 * Opens a cache directory, creating it if it doesn't exist.
+	 * \param directory the path of the cache directory
+	 * \returns whether the directory could be used
+	 */
+	bool open(const std::string &directory);
+
+	/**
+	 * Looks up an encoded frame.
+	 * \param key the key of the frame
+	 * \param buffer the buffer to append the frame to if it is found
+	 * \returns whether the frame was found and is intact
+	 */
+	bool load(const CacheKey &key, std::vector<uint8_t> &buffer) const;
+
+	/**
+	 * Stores an encoded frame. A failure to store the frame is not an error, the frame is just encoded again next time.
+	 * \param key the key of the frame
+	 * \param data pointer to the encoded frame
+	 * \param size the size of the encoded frame in bytes
+	 */
+	void store(const CacheKey &key, const uint8_t *data, size_t size) const;
+private:
+	std::string directory_;
+	uint64_t instance_;
+	mutable std::atomic<uint64_t> stored_;
+};
+
+#endif // FLICTOOL_CHUNKCACHE_H
\ No newline at end of file
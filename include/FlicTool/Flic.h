@@ -4,10 +4,18 @@
 
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include "Bitmap.h"
+#include "ChunkCache.h"
+#include "FrameHash.h"
+#include "Stats.h"
+
+class FlicReader;
+class NearMatchFilter;
+class Palette;
 
 #pragma pack(push, 1)
 struct FlicHeader {
@@ -55,139 +63,377 @@ struct FlicChunkHeader {
 #pragma pack(pop)
 
 struct FlicFrame {
-	uint8_t *pixels;
+	std::vector<uint8_t> pixels;
+};
+
+/**
+ * What decompiling writes the frames as.
+ */
+enum class FrameFormat {
+	/**
+	 * A 16-bit bitmap file for every frame, named frameNNNN.bmp.
+	 */
+	Bitmap,
+	/**
+	 * A single stream of raw 16-bit little-endian pixels with 5 bits per channel, one frame after another, every
+	 * frame starting with its top row.
+	 */
+	Rgb555,
+	/**
+	 * A single stream of raw pixels of one byte each for red, green and blue, one frame after another, every frame
+	 * starting with its top row.
+	 */
+	Rgb24
+};
+
+/**
+ * The header that can start a stream of raw frames, so that the reader doesn't need to be told what it holds.
+ */
+#pragma pack(push, 1)
+struct FrameStreamHeader {
+	char magic[4]; // FLRS
+	uint16_t version;
+	/**
+	 * The layout of the pixels, 1 for RGB555 and 2 for RGB24, see FrameFormat.
+	 */
+	uint16_t format;
+	uint16_t width;
+	uint16_t height;
+	uint32_t frames;
+	/**
+	 * How long every frame is shown in milliseconds, or 0 if the Flic file doesn't say, in which case the game shows
+	 * 25 frames per second.
+	 */
+	uint32_t speed;
 };
+#pragma pack(pop)
 
-struct Packet {
-	char *data;
-	size_t size;
+/**
+ * How an encoded frame was produced.
+ */
+enum class FrameEncoding {
+	Encoded,
+	Duplicate,
+	Cached
+};
+
+/**
+ * A frame of the animation being compiled, along with the hashes of its pixels.
+ */
+struct SourceFrame {
+	Bitmap bitmap;
+	FrameHash hash;
 };
 
 struct SubChunk {
-	uint8_t pixelSkip;
+	uint32_t pixelSkip;
 	const uint8_t *start;
+	uint32_t x;
 	size_t length;
 };
 
+struct CompileOptions {
+	/**
+	 * The number of threads used to encode frames. 0 means one per hardware thread.
+	 */
+	uint32_t jobs = 1;
+
+	/**
+	 * The number of threads used to load and convert frames ahead of the encoder. 0 means one per hardware thread.
+	 */
+	uint32_t loaders = 1;
+
+	/**
+	 * The largest number of frames that are loaded ahead of the encoder, which caps the memory the loaders use.
+	 * 0 means twice the number of loader threads.
+	 */
+	uint32_t prefetch = 0;
+
+	/**
+	 * Every frame whose index is a multiple of this is encoded as a DTA_BRUN keyframe. 0 only makes the first frame a keyframe.
+	 */
+	uint32_t keyframeInterval = 0;
+
+	/**
+	 * Whether every line is encoded with the smallest possible packets instead of the faster greedy encoder.
+	 */
+	bool optimal = false;
+
+	/**
+	 * Whether every frame is encoded as the smallest of a DTA_LC delta, a DTA_BRUN frame and a DTA_COPY frame,
+	 * instead of only making keyframes DTA_BRUN frames and the rest DTA_LC deltas. Off by default, since players that
+	 * only know the DTA_BRUN and DTA_LC chunks can't read DTA_COPY frames.
+	 */
+	bool adaptiveChunks = false;
+
+	/**
+	 * Whether frames with more than 5 bits per channel are converted with an ordered dither instead of rounding every
+	 * pixel to the nearest color.
+	 */
+	bool dither = false;
+
+	/**
+	 * Whether the animation is stored with 8-bit pixels and a palette of up to 256 colors, using FLI_COLOR, FLI_BRUN
+	 * and FLI_LC chunks. The palette is built from every frame, so the frames are read twice.
+	 */
+	bool palettized = false;
+
+	/**
+	 * The largest difference of any 5-bit channel between a pixel and the same pixel of the previous frame for which
+	 * the pixel is left unchanged, which makes deltas smaller at the cost of some accuracy. 0 stores every frame exactly.
+	 * Pixels are compared to what the previous frame was stored as, so the error never grows past the tolerance.
+	 */
+	uint32_t tolerance = 0;
+
+	/**
+	 * A directory to keep encoded frames in, so that frames whose pixels and settings haven't changed since the last
+	 * compile don't need to be encoded again. An empty string disables the cache.
+	 */
+	std::string cacheDirectory;
+
+	/**
+	 * Where to record how long every stage takes and how every frame was encoded, or nullptr to record nothing.
+	 */
+	Stats *stats = nullptr;
+
+	/**
+	 * Whether to leave out the progress messages, errors are still reported.
+	 */
+	bool quiet = false;
+};
+
+struct DecompileOptions {
+	/**
+	 * The number of threads used to save frames. 0 means one per hardware thread.
+	 */
+	uint32_t jobs = 1;
+
+	/**
+	 * The number of a single frame to extract, counting from 1. 0 extracts every frame.
+	 */
+	uint32_t frame = 0;
+
+	/**
+	 * What to write the frames as. Raw frames are written to a single file, or to standard output if it is -.
+	 */
+	FrameFormat format = FrameFormat::Bitmap;
+
+	/**
+	 * Whether a stream of raw frames starts with a FrameStreamHeader.
+	 */
+	bool streamHeader = false;
+
+	/**
+	 * Where to record how long every stage takes and how every frame was decoded, or nullptr to record nothing.
+	 */
+	Stats *stats = nullptr;
+
+	/**
+	 * Whether to leave out the progress messages, errors are still reported.
+	 */
+	bool quiet = false;
+};
+
+struct PlayOptions {
+	/**
+	 * The number of times to play the animation.
+	 */
+	uint32_t loops = 1;
+};
+
 class Flic {
 public:
 	/**
 	 * Compiles the frames found in the specified directory to create a new FLH file.
 	 * \param input the input directory name
-	 * \param output the output filename
+	 * \param output the output filename, or - to write the file to standard output. When the output isn't a regular
+	 * file, like standard output or a pipe, the file is assembled in memory and written in a single pass.
+	 * \param options settings controlling how the frames are encoded
+	 * \returns whether the file was compiled successfully
+	 */
+	bool compile(const std::string &input, const std::string &output, const CompileOptions &options = CompileOptions());
+
+	/**
+	 * Re-encodes an existing FLH file with the current encoder and the specified settings, without writing the frames
+	 * to bitmap files in between. Every frame is decoded in memory and encoded against the previous decoded frame,
+	 * with decoding running ahead of the encoder in a separate thread.
+	 * \param input the FLH file to optimize
+	 * \param output the output filename, which has to be a different file than the input since the input is read while
+	 * the output is written, or - to write the file to standard output
+	 * \param options settings controlling how the frames are encoded, the number of loaders is ignored
+	 * \returns whether the file was optimized successfully
 	 */
-	void compile(const std::string &input, const std::string &output);
+	bool optimize(const std::string &input, const std::string &output, const CompileOptions &options = CompileOptions());
 
 	/**
-	 * Decompiles the specified FLH file to create separate frames.
+	 * Decompiles the specified FLH file to create separate frames, or a single stream of raw frames.
 	 * \param input the file to decompile
-	 * \param output the output directory to place frames in
+	 * \param output the output directory to place frames in, or the file to write raw frames to, which can be - for
+	 * standard output
+	 * \param options settings controlling how the frames are saved
+	 * \returns whether every frame was decompiled successfully
 	 */
-	void decompile(const std::string &input, const std::string &output);
-private:
+	bool decompile(const std::string &input, const std::string &output, const DecompileOptions &options = DecompileOptions());
+
 	/**
-	 * Writes a Flic Repeat Packet. Used in DTA_BRUN chunks.
-	 * \param data pointer to the pixel to repeat
-	 * \param count the amount of times to repeat the pixel
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param packets the vector to append the resulting packet to
+	 * Decodes every frame of the specified FLH file as fast as possible without saving it, and reports the frame
+	 * rate, the slowest frame and the size of the frames. The animation keeps up in real time if no frame takes
+	 * longer to decode than it is shown for.
+	 * \param input the file to play
+	 * \param options settings controlling how the file is played
+	 * \returns whether every frame could be decoded and the animation keeps up in real time
 	 */
-	void writeRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<Packet> &packets);
+	bool playNull(const std::string &input, const PlayOptions &options = PlayOptions());
 
 	/**
-	 * Writes a Flic Copy Packet. Used in DTA_BRUN chunks.
-	 * \param data pointer to the first pixel to copy
-	 * \param count the amount of pixels to copy
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param packets the vector to append the resulting packet to
+	 * Encodes frames held in memory into a FLH file in memory. Every frame is width * height 16-bit pixels, laid out
+	 * like the pixel data of a 16-bit bitmap with the bottom row first. The frames are read where they are and encoded
+	 * straight into the output buffer, on the calling thread.
+	 * \param frames pointers to the pixel data of the frames, in order
+	 * \param count the number of frames
+	 * \param width the width of the frames in pixels, at most 32385 so that every line fits the packet count
+	 * \param height the height of the frames in pixels
+	 * \param output the buffer to append the FLH file to
+	 * \param options settings controlling how the frames are encoded, the number of jobs is ignored
+	 * \returns whether the frames could be encoded
 	 */
-	void writeCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<Packet> &packets);
+	bool encode(const uint8_t *const *frames, uint32_t count, uint32_t width, uint32_t height, std::vector<uint8_t> &output, const CompileOptions &options = CompileOptions());
 
 	/**
-	 * Writes a Flic Delta Repeat Packet. Used in DTA_LC chunks.
-	 * \param data pointer to the pixel to repeat
-	 * \param count the amount of times to repeat the pixel
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param pixelSkip the amount of pixels to skip before this packet
-	 * \param packets the vector to append the resulting packet to
+	 * Decodes a FLH file held in memory into frame buffers owned by the caller, in the layout \code encode \endcode takes.
+	 * The file data is read where it is.
+	 * \param data pointer to the contents of the FLH file
+	 * \param size the size of the FLH file in bytes
+	 * \param frameBuffer called with the header of the file and the index of every frame, in order, and returns the
+	 * buffer of width * height * 2 bytes to decode the frame into, or nullptr to stop decoding
+	 * \returns whether every frame was decoded
+	 */
+	bool decode(const uint8_t *data, size_t size, const std::function<uint8_t *(const FlicHeader &header, uint32_t index)> &frameBuffer);
+private:
+	/**
+	 * The function that provides the 16-bit pixels of a frame to encode. It is called on a loader thread.
 	 */
-	void writeDeltaRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint8_t pixelSkip, std::vector<Packet> &packets);
+	typedef std::function<bool(uint32_t index, Bitmap &bmp)> LoadFunction;
 
 	/**
-	 * Writes a Flic Delta Copy Packet. Used in DTA_LC chunks.
-	 * \param data pointer to the first pixel to copy
-	 * \param count the amount of pixels to copy
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param pixelSkip the amount of pixels to skip before this packet
-	 * \param packets the vector to append the resulting packet to
+	 * Encodes and writes the frames of an animation, all but the first of them provided by a load function.
+	 * \param header the header of the Flic Animation file being created, with the number and dimensions of its frames
+	 * \param first the first frame of the animation, with its 16-bit pixels
+	 * \param loaders the number of threads calling the load function, which may be called for several frames at once
+	 * unless this is 1
+	 * \param load the function providing the rest of the frames
+	 * \param output the output filename, or - to write the file to standard output
+	 * \param options settings controlling how the frames are encoded
+	 * \returns whether the file was written successfully
 	 */
-	void writeDeltaCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint8_t pixelSkip, std::vector<Packet> &packets);
+	bool encodeAnimation(FlicHeader header, SourceFrame &first, uint32_t loaders, const LoadFunction &load, const std::string &output, const CompileOptions &options);
 
 	/**
-	 * Encodes the specified line of pixels as DTA_BRUN packets.
-	 * \param data pointer to the first pixel in the line to encode
-	 * \param width the width of the line in pixels
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param packets the vector to append the resulting packets to
+	 * Loads a bitmap and makes sure it matches the dimensions of the animation.
+	 * \param header the header of the Flic Animation file being created
+	 * \param filename the path of the bitmap file to load
+	 * \param options the options of the compile
+	 * \param bmp the bitmap to load the file into
+	 * \returns whether the bitmap could be loaded
 	 */
-	void encodeRle(const uint8_t *data, uint32_t width, uint8_t bpp, std::vector<Packet> &packets);
+	bool loadBitmap(const FlicHeader &header, const std::string &filename, const CompileOptions &options, Bitmap &bmp);
 
 	/**
-	 * Compares a line of pixels to the same line of the previous frame and determines which pixels have been updated.
-	 * The resulting sub-chunks can then be encoded separately.
-	 * \param data pointer to the first pixel in the line to encode
-	 * \param oldData pointer to the first pixel in the same line of the previous frame
-	 * \param width the width of the line in pixels
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param subchunks the vector to append the resulting subchunks to
+	 * Converts the 16-bit pixels of a frame to the depth of the animation and hashes them.
+	 * \param header the header of the Flic Animation file being created
+	 * \param palette the palette to convert the frame to, or nullptr to keep its 16-bit pixels
+	 * \param options the options of the compile
+	 * \param frame the frame to convert
 	 */
-	void getSubChunks(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, std::vector<SubChunk> &subChunks);
+	static void prepareFrame(const FlicHeader &header, const Palette *palette, const CompileOptions &options, SourceFrame &frame);
 
 	/**
-	 * Encodes the specified line of pixels as DTA_LC packets.
-	 * \param data pointer to the first pixel in the line to encode
-	 * \param oldData pointer to the first pixel in the same line of the previous frame
-	 * \param width the width of the line in pixels
-	 * \param bpp the bit depth of the Flic Animation
-	 * \param packets the vector to append the resulting packets to
+	 * Lets the pixels of a frame that are close enough to the previous frame keep the pixels of the previous frame,
+	 * then converts and hashes the frame like \code prepareFrame \endcode and measures the error of the result.
+	 * Frames have to be filtered in order.
+	 * \param header the header of the Flic Animation file being created
+	 * \param palette the palette to convert the frame to, or nullptr to keep its 16-bit pixels
+	 * \param options the options of the compile
+	 * \param filter the filter holding what the previous frame was stored as
+	 * \param keyframe whether the frame is a keyframe, which is stored exactly
+	 * \param frame the frame to filter, with its 16-bit source pixels
 	 */
-	void encodeDeltaRle(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, std::vector<Packet> &packets);
+	static void filterFrame(const FlicHeader &header, const Palette *palette, const CompileOptions &options, NearMatchFilter &filter, bool keyframe, SourceFrame &frame);
 
 	/**
-	 * Creates a DTA_BRUN chunk by RLE-encoding a bitmap file.
+	 * Encodes a single frame of the animation, DTA_BRUN for keyframes and DTA_LC for the rest.
+	 * With adaptive chunks, the frame is stored as a DTA_BRUN or DTA_COPY frame instead whenever that is smaller.
+	 * A frame that repeats the previous frame is stored as an empty DTA_LC chunk, found by its hashes alone.
 	 * \param header the header of the Flic Animation file being created
-	 * \param bmp the bitmap to encode
-	 * \param os the output stream to write the resulting chunk to
-	 * \returns the size of the chunk in bytes
+	 * \param previous the previous frame, or nullptr if this frame is a keyframe
+	 * \param current the frame to encode
+	 * \param options settings controlling how the frame is encoded
+	 * \param cache the cache to look the frame up in and store it in, or nullptr to always encode the frame
+	 * \param palette the palette of an 8-bit animation, which keyframes carry in a FLI_COLOR chunk, or nullptr
+	 * \param buffer the buffer to append the resulting frame to
+	 * \param encoding receives how the frame was produced
+	 * \param packets receives the number of packets in the frame, or -1 if the frame came from the cache, unless it is nullptr
+	 * \returns the size of the frame in bytes
 	 */
-	uint32_t createBrun(const FlicHeader &header, const Bitmap &bmp, std::ostream &os);
+	uint32_t encodeFrame(const FlicHeader &header, const SourceFrame *previous, const SourceFrame &current, const CompileOptions &options, const ChunkCache *cache, const Palette *palette, std::vector<uint8_t> &buffer, FrameEncoding &encoding, int64_t *packets = nullptr);
 
 	/**
-	 * Creates a DTA_LC chunk by comparing a bitmap file to the last frame and RLE-encoding the updated pixels.
+	 * Makes the cache key of a frame from the hashes of the frame and the previous frame, and the settings it is encoded with.
 	 * \param header the header of the Flic Animation file being created
-	 * \param lastBmp the previous bitmap
-	 * \param bmp the current bitmap
-	 * \param os the output stream to write the resulting chunk to
-	 * \returns the size of the chunk in bytes
+	 * \param previous the previous frame, or nullptr if this frame is a keyframe
+	 * \param current the frame to encode
+	 * \param options settings controlling how the frame is encoded
+	 * \param palette the palette of an 8-bit animation, or nullptr
+	 * \returns the key of the encoded frame
 	 */
-	uint32_t createLc(const FlicHeader &header, const Bitmap &lastBmp, const Bitmap &bmp, std::ostream &os);
+	static CacheKey cacheKey(const FlicHeader &header, const SourceFrame *previous, const SourceFrame &current, const CompileOptions &options, const Palette *palette);
 
 	/**
-	 * Reads a DTA_BRUN chunk and updates the specified Flic frame.
+	 * Writes an encoded frame to the Flic Animation file. The file header is written along with the first frame.
 	 * \param header the header of the Flic Animation file being created
-	 * \param frame the frame to update
-	 * \param is the input stream from which to read chunk data
+	 * \param index the index of the frame
+	 * \param buffer the encoded frame
+	 * \param os the output stream to write the frame to, or nullptr to append it to file instead
+	 * \param file the file being assembled in memory when the output can't seek back to fill in its size
 	 */
-	void readBrun(const FlicHeader &header, FlicFrame &frame, std::istream &is);
+	void writeFrame(FlicHeader &header, uint32_t index, const std::vector<uint8_t> &buffer, std::ostream *os, std::vector<uint8_t> &file);
 
 	/**
-	 * Reads a DTA_LC chunk and updates the specified Flic frame.
-	 * This function assumes that the frame is identical pixel-wise to the previous frame.
+	 * Fills in the fields of the file header that depend on the size of the first frame.
 	 * \param header the header of the Flic Animation file being created
-	 * \param frame the frame to update
-	 * \param is the input stream from which to read chunk data
+	 * \param frameSize the size of the first frame in bytes
+	 */
+	static void setFirstFrameSize(FlicHeader &header, uint32_t frameSize);
+
+	/**
+	 * Decodes a frame of the animation, recording how long it took and how big it was.
+	 * \param reader the reader of the Flic Animation file
+	 * \param index the index of the frame to decode
+	 * \param stats where to record the frame, or nullptr
+	 * \returns whether the frame could be decoded
+	 */
+	static bool decodeFrame(FlicReader &reader, uint32_t index, Stats *stats);
+
+	/**
+	 * Saves a decoded frame as a numbered bitmap file.
+	 * \param header the header of the Flic Animation file being read
+	 * \param pixels the pixel data of the frame
+	 * \param index the index of the frame
+	 * \param output the directory to save the frame in
+	 * \returns whether the frame could be saved
+	 */
+	bool saveFrame(const FlicHeader &header, const uint8_t *pixels, uint32_t index, const std::string &output);
+
+	/**
+	 * Decodes frames of the animation one after another and writes them to a single stream of raw pixels.
+	 * \param reader the reader of the Flic Animation file
+	 * \param first the index of the first frame to write
+	 * \param count the number of frames to write
+	 * \param output the file to write the frames to, or - for standard output
+	 * \param options settings controlling how the frames are written
+	 * \returns whether every frame was decoded and written
 	 */
-	void readLc(const FlicHeader &header, FlicFrame &frame, std::istream &is);
+	bool streamFrames(FlicReader &reader, uint32_t first, uint32_t count, const std::string &output, const DecompileOptions &options);
 
 	/**
 	 * Outputs a nice progress bar.
@@ -196,8 +442,6 @@ private:
 	 * \param w width of the bar in characters
 	 */
 	static inline void progressBar(uint32_t x, uint32_t n, uint32_t w);
-
-	std::vector<FlicFrame> frames_;
 };
 
 #endif // FLICTOOL_FLIC_H
\ No newline at end of file
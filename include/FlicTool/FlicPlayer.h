@@ -0,0 +1,107 @@
+#pragma once
+#ifndef FLICTOOL_FLICPLAYER_H
+#define FLICTOOL_FLICPLAYER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "FlicReader.h"
+
+/**
+ * Plays a Flic Animation file by decoding its frames one after another into
+ * a buffer owned by the caller, either as fast as possible or paced by the
+ * speed in the header of the file.
+ */
+class FlicPlayer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Default constructor.
+	 */
+	FlicPlayer();
+
+	/**
+	 * Opens a Flic Animation file and starts playing it from the first frame.
+	 * \param path the path of the file to open
+	 * \returns whether the file could be opened
+	 */
+	bool open(const std::string &path);
+
+	/**
+	 * Opens a Flic Animation file that is already in memory and starts playing it from the first frame.
+	 * The data isn't copied, so it has to stay valid and unchanged for as long as the player uses it.
+	 * \param data pointer to the contents of the file
+	 * \param size the size of the file in bytes
+	 * \returns whether the data is a valid Rock Raiders Flic file
+	 */
+	bool open(const uint8_t *data, size_t size);
+
+	/**
+	 * \returns the header of the open file
+	 */
+	const FlicHeader &header() const;
+
+	/**
+	 * \returns the offset, size and type of every frame of the open file
+	 */
+	const std::vector<FlicFrameInfo> &frames() const;
+
+	/**
+	 * \returns the number of bytes a frame buffer passed to the player must hold
+	 */
+	size_t frameSize() const;
+
+	/**
+	 * Sets whether the animation starts over from the first frame after the last one.
+	 * \param looping whether to loop
+	 */
+	void setLooping(bool looping);
+
+	/**
+	 * \returns how long every frame is shown, the speed in the header in milliseconds, or 1/25 of a second if the
+	 * header doesn't set a speed, which FlicTool's own compiler doesn't
+	 */
+	Clock::duration frameDuration() const;
+
+	/**
+	 * \returns the index of the frame the next call to \code decodeNext \endcode or \code playNext \endcode decodes
+	 */
+	uint32_t position() const;
+
+	/**
+	 * Goes back to the first frame and restarts the clock that paces \code playNext \endcode.
+	 */
+	void rewind();
+
+	/**
+	 * Decodes the next frame straight away.
+	 * \param target the buffer of \code frameSize \endcode bytes to decode the frame into
+	 * \returns false after the last frame if the animation doesn't loop, or if the frame couldn't be decoded
+	 */
+	bool decodeNext(uint8_t *target);
+
+	/**
+	 * Decodes the next frame and waits until it is due. Frames are due at fixed intervals from the first frame, so
+	 * small delays don't add up. A frame that is decoded late is returned straight away, and when playback falls
+	 * more than a frame behind, the schedule starts over from the late frame instead of rushing to catch up.
+	 * \param target the buffer of \code frameSize \endcode bytes to decode the frame into
+	 * \returns false after the last frame if the animation doesn't loop, or if the frame couldn't be decoded
+	 */
+	bool playNext(uint8_t *target);
+
+	/**
+	 * \returns the number of frames \code playNext \endcode has decoded after they were due
+	 */
+	uint32_t lateFrames() const;
+private:
+	FlicReader reader_;
+	uint32_t next_;
+	bool looping_;
+	bool started_;
+	Clock::time_point due_;
+	uint32_t lateFrames_;
+};
+
+#endif // FLICTOOL_FLICPLAYER_H
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef FLICTOOL_FLICREADER_H
+#define FLICTOOL_FLICREADER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ByteCursor.h"
+#include "Flic.h"
+#include "MappedFile.h"
+
+struct FlicFrameInfo {
+	size_t offset;
+	uint32_t size;
+	bool keyframe;
+};
+
+/**
+ * Decodes the frames of a Flic Animation file, in order or at random.
+ * The file is mapped into memory and indexed once when it is opened, after
+ * which any frame can be decoded by starting at the nearest keyframe before
+ * it. A keyframe is a frame that doesn't depend on the frames before it.
+ */
+class FlicReader {
+public:
+	/**
+	 * Default constructor.
+	 */
+	FlicReader();
+
+	/**
+	 * Opens a Flic Animation file and builds the index of its frames.
+	 * \param path the path of the file to open
+	 * \returns whether the file could be opened and is a valid Rock Raiders Flic file
+	 */
+	bool open(const std::string &path);
+
+	/**
+	 * Opens a Flic Animation file that is already in memory and builds the index of its frames.
+	 * The data isn't copied, so it has to stay valid and unchanged for as long as the reader uses it.
+	 * \param data pointer to the contents of the file
+	 * \param size the size of the file in bytes
+	 * \returns whether the data is a valid Rock Raiders Flic file
+	 */
+	bool open(const uint8_t *data, size_t size);
+
+	/**
+	 * \returns the header of the open file
+	 */
+	const FlicHeader &header() const;
+
+	/**
+	 * \returns the offset, size and type of every frame of the open file
+	 */
+	const std::vector<FlicFrameInfo> &frames() const;
+
+	/**
+	 * Decodes the specified frame. Decoding the frame following the last
+	 * decoded frame only decodes that one frame, any other frame is decoded
+	 * starting at the nearest keyframe before it.
+	 * \param index the index of the frame to decode
+	 * \returns whether the frame could be decoded
+	 */
+	bool decodeFrame(uint32_t index);
+
+	/**
+	 * \returns the 16-bit pixel data of the last decoded frame. The colors of an 8-bit file are looked up in its palette
+	 */
+	const uint8_t *pixels() const;
+
+	/**
+	 * \returns the size in bytes of the pixel data of a frame, which always has 16 bits per pixel
+	 */
+	size_t frameSize() const;
+private:
+	/**
+	 * Reads the header of a Flic Animation file and builds the index of its frames.
+	 * \param data pointer to the contents of the file
+	 * \param size the size of the file in bytes
+	 * \returns whether the data is a valid Rock Raiders Flic file
+	 */
+	bool parse(const uint8_t *data, size_t size);
+
+	/**
+	 * Scans the frame and chunk headers of the file and records where each frame starts.
+	 * \param cursor the cursor positioned at the first frame of the file
+	 * \returns false if the frame headers are invalid
+	 */
+	bool buildIndex(ByteCursor &cursor);
+
+	/**
+	 * Applies all chunks of a frame to the current frame buffer.
+	 * \param index the index of the frame to apply
+	 * \returns false if the frame data is invalid
+	 */
+	bool applyFrame(uint32_t index);
+
+	/**
+	 * Reads a FLI_COLOR chunk and updates the palette.
+	 * \param cursor the cursor over the chunk data
+	 * \returns false if the chunk data is invalid
+	 */
+	bool readColor(ByteCursor &cursor);
+
+	MappedFile file_;
+	const uint8_t *data_;
+	size_t size_;
+	FlicHeader header_;
+	std::vector<FlicFrameInfo> frames_;
+	FlicFrame frame_;
+	std::vector<uint16_t> palette_;
+	std::vector<uint8_t> expanded_;
+	int64_t current_;
+};
+
+#endif // FLICTOOL_FLICREADER_H
\ No newline at end of file
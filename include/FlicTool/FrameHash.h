@@ -0,0 +1,52 @@
+#pragma once
+#ifndef FLICTOOL_FRAMEHASH_H
+#define FLICTOOL_FRAMEHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The hashes of a frame and of every line in it, used to find repeated
+ * frames and lines without comparing their pixels. Equal hashes are taken
+ * to mean equal pixels, which a 64-bit hash can't promise, but a collision
+ * is unlikely enough to accept for lines.
+ */
+struct FrameHash {
+	uint64_t frame = 0;
+	std::vector<uint64_t> lines;
+
+	/**
+	 * \returns whether both frames have the same hashes. The compiler treats equal hashes as equal pixels, so
+	 * a collision would make it silently skip a line that did change. Repeated frames are confirmed by their pixels
+	 */
+	bool operator==(const FrameHash &other) const {
+		return frame == other.frame && lines == other.lines;
+	}
+
+	bool operator!=(const FrameHash &other) const {
+		return !(*this == other);
+	}
+};
+
+/**
+ * Computes a 64-bit hash of a block of memory. This isn't a cryptographic
+ * hash, but changing any bits of the input changes the hash.
+ * \param data pointer to the first byte to hash
+ * \param size the number of bytes to hash
+ * \param seed a value to start from, which can be used to chain hashes together
+ * \returns the hash of the bytes
+ */
+uint64_t hashBytes(const uint8_t *data, size_t size, uint64_t seed = 0);
+
+/**
+ * Hashes every line of a frame, and the frame as a whole.
+ * \param pixels pointer to the pixel data of the frame
+ * \param width the width of the frame in pixels
+ * \param height the height of the frame in pixels
+ * \param bpp the number of bytes per pixel
+ * \param hash receives the hashes of the frame
+ */
+void hashFrame(const uint8_t *pixels, uint32_t width, uint32_t height, uint8_t bpp, FrameHash &hash);
+
+#endif // FLICTOOL_FRAMEHASH_H
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef FLICTOOL_FRAMELOADER_H
+#define FLICTOOL_FRAMELOADER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Flic.h"
+
+/**
+ * Loads a range of frames ahead of the encoder on a pool of threads and
+ * hands them out in order. The threads never run further ahead of the
+ * frame being handed out than the prefetch depth, which bounds the number
+ * of frames held in memory.
+ */
+class FrameLoader {
+public:
+	/**
+	 * The function that loads a single frame. It is called on the loader threads, for several frames at once.
+	 */
+	typedef std::function<bool(uint32_t index, SourceFrame &frame)> LoadFunction;
+
+	/**
+	 * Starts loading frames.
+	 * \param begin the index of the first frame to load
+	 * \param end the index after the last frame to load
+	 * \param threads the number of threads to load frames on
+	 * \param prefetch the largest number of frames that are loaded but not yet handed out
+	 * \param load the function that loads a frame
+	 */
+	FrameLoader(uint32_t begin, uint32_t end, uint32_t threads, uint32_t prefetch, const LoadFunction &load);
+
+	/**
+	 * Stops loading frames, waiting for the frames that are being loaded.
+	 */
+	~FrameLoader();
+
+	/**
+	 * Waits for the next frame in order and hands it out.
+	 * \param frame receives the frame
+	 * \returns false if every frame has been handed out or the next frame couldn't be loaded
+	 */
+	bool next(SourceFrame &frame);
+private:
+	FrameLoader(const FrameLoader &);
+	FrameLoader &operator=(const FrameLoader &);
+
+	struct LoadedFrame {
+		bool success;
+		SourceFrame frame;
+	};
+
+	void run();
+
+	uint32_t next_;
+	uint32_t end_;
+	uint32_t claimed_;
+	uint32_t prefetch_;
+	bool stopped_;
+	LoadFunction load_;
+	std::map<uint32_t, LoadedFrame> loaded_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::vector<std::thread> threads_;
+};
+
+#endif // FLICTOOL_FRAMELOADER_H
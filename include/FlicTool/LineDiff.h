@@ -0,0 +1,55 @@
+#pragma once
+#ifndef FLICTOOL_LINEDIFF_H
+#define FLICTOOL_LINEDIFF_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * \returns the number of 64-bit words needed for a mask with one bit per pixel of a line
+ * \param width the width of the line in pixels
+ */
+inline size_t maskWords(uint32_t width) {
+	return (width + 63) / 64;
+}
+
+/**
+ * \returns whether the bit of the specified pixel is set in a mask
+ * \param mask the mask to test
+ * \param x the index of the pixel
+ */
+inline bool testMaskBit(const uint64_t *mask, uint32_t x) {
+	return ((mask[x / 64] >> (x % 64)) & 1) != 0;
+}
+
+/**
+ * Finds the next pixel whose bit in a mask has the specified value.
+ * \param mask the mask to search
+ * \param from the index of the first pixel to look at
+ * \param width the width of the line in pixels
+ * \param value the bit value to look for
+ * \returns the index of the pixel found, or width if there is none
+ */
+uint32_t findMaskBit(const uint64_t *mask, uint32_t from, uint32_t width, bool value);
+
+/**
+ * Compares a line of pixels to the same line of the previous frame, and
+ * every pixel of the line to the pixel before it, producing one bit per pixel.
+ * Lines of 16-bit pixels are compared with SSE2 or AVX2 when the CPU
+ * supports it.
+ * \param data pointer to the first pixel in the line
+ * \param oldData pointer to the first pixel in the same line of the previous frame, or nullptr to skip that comparison
+ * \param width the width of the line in pixels
+ * \param bpp the number of bytes per pixel
+ * \param changed receives a bit for every pixel that differs from the previous frame, unused if oldData is nullptr
+ * \param same receives a bit for every pixel that is equal to the pixel before it
+ * \returns whether any pixel differs from the previous frame
+ */
+bool diffLine(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, uint64_t *changed, uint64_t *same);
+
+/**
+ * \returns the name of the kernel \code diffLine \endcode uses for 16-bit pixels on this CPU
+ */
+const char *diffKernelName();
+
+#endif // FLICTOOL_LINEDIFF_H
\ No newline at end of file
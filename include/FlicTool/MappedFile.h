@@ -0,0 +1,58 @@
+#pragma once
+#ifndef FLICTOOL_MAPPEDFILE_H
+#define FLICTOOL_MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace boost {
+	namespace interprocess {
+		class file_mapping;
+		class mapped_region;
+	}
+}
+
+/**
+ * A read-only view of a file mapped into memory.
+ */
+class MappedFile {
+public:
+	/**
+	 * Default constructor.
+	 */
+	MappedFile();
+
+	~MappedFile();
+
+	/**
+	 * Maps the specified file into memory, replacing any file mapped before.
+	 * \param path the path of the file to map
+	 * \returns whether the file could be mapped
+	 */
+	bool open(const std::string &path);
+
+	/**
+	 * Unmaps the file, if one is mapped.
+	 */
+	void close();
+
+	/**
+	 * \returns a pointer to the contents of the file, or nullptr if the file is empty
+	 */
+	const uint8_t *data() const;
+
+	/**
+	 * \returns the size of the file in bytes
+	 */
+	size_t size() const;
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	std::unique_ptr<boost::interprocess::file_mapping> mapping_;
+	std::unique_ptr<boost::interprocess::mapped_region> region_;
+};
+
+#endif // FLICTOOL_MAPPEDFILE_H
\ No newline at end of file
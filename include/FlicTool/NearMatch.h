@@ -0,0 +1,58 @@
+#pragma once
+#ifndef FLICTOOL_NEARMATCH_H
+#define FLICTOOL_NEARMATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Makes an animation cheaper to store as deltas by letting pixels that are
+ * only slightly different from the previous frame keep the pixel of the
+ * previous frame. Pixels are compared to the frame the player will have
+ * shown, not to the previous source frame, so a pixel never drifts further
+ * from its source than the tolerance, no matter how many frames it is kept.
+ * Frames have to be filtered in order.
+ */
+class NearMatchFilter {
+public:
+	/**
+	 * Creates a filter for the frames of an animation.
+	 * \param width the width of the frames in pixels
+	 * \param height the height of the frames in pixels
+	 * \param tolerance the largest difference of any 5-bit channel for which a pixel still counts as unchanged
+	 */
+	NearMatchFilter(uint32_t width, uint32_t height, uint32_t tolerance);
+
+	/**
+	 * Filters the next frame of the animation.
+	 * \param source pointer to the 16-bit pixels of the frame
+	 * \param target receives the pixels to encode instead, the pixels of the previous frame wherever they are
+	 * close enough to the source
+	 * \param keyframe whether the frame is a keyframe, which is always kept exactly
+	 * \returns the number of pixels that kept the pixel of the previous frame
+	 */
+	size_t apply(const uint8_t *source, uint8_t *target, bool keyframe);
+
+	/**
+	 * Adds the difference between the source pixels of a frame and the pixels that are stored for it to the error.
+	 * \param source pointer to the 16-bit pixels of the frame
+	 * \param stored pointer to the pixels stored for the frame, 16-bit pixels or 8-bit indices into the palette
+	 * \param palette the colors of the palette of an 8-bit animation, or nullptr if the stored pixels are 16-bit
+	 */
+	void measure(const uint8_t *source, const uint8_t *stored, const uint16_t *palette);
+
+	/**
+	 * \returns the peak signal to noise ratio of every frame measured so far in dB, with 31 as the peak of a
+	 * channel, or infinity if every frame has been stored exactly
+	 */
+	double psnr() const;
+private:
+	size_t pixels_;
+	uint32_t tolerance_;
+	std::vector<uint16_t> last_;
+	uint64_t squaredError_;
+	uint64_t samples_;
+};
+
+#endif // FLICTOOL_NEARMATCH_H
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef FLICTOOL_PALETTE_H
+#define FLICTOOL_PALETTE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A palette of up to 256 colors for storing an animation as 8-bit pixels,
+ * built from how often every color appears in its frames. Colors are 16-bit
+ * pixels with 5 bits for each of red, green and blue, so an animation with
+ * no more than 256 different colors keeps every one of them exactly.
+ * Otherwise the colors are split into boxes with median cut, and the boxes
+ * are refined with a few rounds of k-means.
+ */
+class Palette {
+public:
+	/**
+	 * Creates an empty palette with no colors counted.
+	 */
+	Palette();
+
+	/**
+	 * Counts the colors of a frame.
+	 * \param pixels pointer to the 16-bit pixels of the frame
+	 * \param count the number of pixels
+	 */
+	void addPixels(const uint8_t *pixels, size_t count);
+
+	/**
+	 * Chooses the colors of the palette from the colors counted so far.
+	 * \param maxColors the largest number of colors the palette may have, at most 256
+	 */
+	void build(uint32_t maxColors = 256);
+
+	/**
+	 * \returns the colors of the palette as 16-bit pixels
+	 */
+	const std::vector<uint16_t> &colors() const;
+
+	/**
+	 * Replaces every pixel with the index of the nearest color in the palette.
+	 * \param pixels pointer to the 16-bit pixels to convert
+	 * \param indices receives the 8-bit index of every pixel
+	 * \param count the number of pixels
+	 */
+	void map(const uint8_t *pixels, uint8_t *indices, size_t count) const;
+
+	/**
+	 * \returns a hash of the colors of the palette
+	 */
+	uint64_t hash() const;
+private:
+	uint8_t nearest(uint16_t color) const;
+
+	std::vector<uint64_t> histogram_;
+	std::vector<uint16_t> colors_;
+	std::vector<uint8_t> lookup_;
+};
+
+#endif // FLICTOOL_PALETTE_H
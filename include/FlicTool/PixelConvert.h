@@ -0,0 +1,57 @@
+#pragma once
+#ifndef FLICTOOL_PIXELCONVERT_H
+#define FLICTOOL_PIXELCONVERT_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Converts lines of bitmap pixels described by channel bit masks to the
+ * 16-bit pixels of Flic Animation files, with 5 bits for each of red, green
+ * and blue. The common 24-bit and 32-bit layouts are converted with SSSE3
+ * when the CPU supports it, and every other layout goes through a lookup
+ * table per channel.
+ */
+class PixelConverter {
+public:
+	/**
+	 * Prepares the conversion of pixels of the specified layout.
+	 * \param bpp the number of bits per source pixel, 16, 24 or 32
+	 * \param bitMask the bit masks of the blue, green and red channels, followed by the alpha channel, which is ignored
+	 * \param dither whether to spread the rounding error of channels with more than 5 bits over neighbouring pixels
+	 * with an ordered dither, instead of rounding every pixel to the nearest color
+	 */
+	PixelConverter(uint32_t bpp, const uint32_t *bitMask, bool dither);
+
+	/**
+	 * Converts a line of pixels.
+	 * \param source pointer to the first pixel in the line
+	 * \param target pointer to where the first converted pixel should be written
+	 * \param width the width of the line in pixels
+	 * \param y the index of the line, which decides the dither pattern
+	 */
+	void convertLine(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t y) const;
+
+	/**
+	 * \returns the name of the kernel used to convert pixels of this layout on this CPU
+	 */
+	const char *kernelName() const;
+private:
+	void convertStandard(const uint8_t *source, uint16_t *target, uint32_t from, uint32_t width, uint32_t y) const;
+
+	void convertMasked(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t y) const;
+
+	uint32_t stride_;
+	bool dither_;
+	bool standard_;
+	uint32_t bitMask_[3];
+	uint32_t bitShift_[3];
+
+	/**
+	 * For every value of a channel, either its 5-bit value already shifted
+	 * into place or, when dithering, its value scaled to 8 bits.
+	 */
+	std::vector<uint16_t> tables_[3];
+};
+
+#endif // FLICTOOL_PIXELCONVERT_H
\ No newline at end of file
@@ -0,0 +1,161 @@
+#pragma once
+#ifndef FLICTOOL_STATS_H
+#define FLICTOOL_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * The stages of compiling and decompiling that are timed separately.
+ */
+enum class Stage {
+	Scan,
+	Load,
+	Downsample,
+	Filter,
+	Hash,
+	Diff,
+	Packetize,
+	Write,
+	Decode,
+	Save,
+	Count
+};
+
+/**
+ * What is known about a single compiled or decompiled frame.
+ */
+struct FrameStats {
+	uint32_t index;
+	/**
+	 * The type of the chunk holding the frame, see FlicChunkType, or 0 if it isn't known.
+	 */
+	uint16_t chunkType;
+	/**
+	 * "encoded", "duplicate" or "cached" for compiled frames, "decoded" for decompiled frames.
+	 */
+	const char *encoding;
+	uint32_t bytes;
+	/**
+	 * The number of packets in the chunk, or -1 if it isn't known because the frame came from the cache.
+	 */
+	int64_t packets;
+	/**
+	 * The number of allocations made while encoding or decoding the frame.
+	 */
+	uint64_t allocations;
+	double seconds;
+};
+
+/**
+ * Collects how long every stage of a compile or decompile takes and how
+ * every frame turned out, and writes them out as JSON. Stages can be timed
+ * from any number of threads at once, so the time of a stage is the sum
+ * over every thread that ran it and can exceed the wall time.
+ */
+class Stats {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * Starts the wall clock of the whole operation.
+	 * \param operation "compile" or "decompile"
+	 * \param input the input path
+	 * \param output the output path
+	 */
+	Stats(const std::string &operation, const std::string &input, const std::string &output);
+
+	/**
+	 * Adds time spent in a stage.
+	 * \param stage the stage
+	 * \param start when the stage started, the stage ends now
+	 * \returns the current time, so that the next stage can start where this one ended
+	 */
+	Clock::time_point record(Stage stage, Clock::time_point start);
+
+	/**
+	 * Adds time spent in a stage that has been measured by the caller, for stages that run many times per frame.
+	 * \param stage the stage
+	 * \param duration the time spent in the stage
+	 * \param calls the number of times the stage ran
+	 */
+	void add(Stage stage, Clock::duration duration, uint64_t calls = 1);
+
+	/**
+	 * Records the results of a frame. Frames can be added in any order.
+	 * \param frame the results of the frame
+	 */
+	void addFrame(const FrameStats &frame);
+
+	/**
+	 * Sets the dimensions of the animation, which are used for the compression ratios.
+	 * \param frames the number of frames
+	 * \param width the width of the frames in pixels
+	 * \param height the height of the frames in pixels
+	 * \param depth the number of bits per pixel
+	 */
+	void setAnimation(uint32_t frames, uint32_t width, uint32_t height, uint32_t depth);
+
+	/**
+	 * Sets how close the stored frames are to the source frames, for compiles that don't store them exactly.
+	 * \param psnr the peak signal to noise ratio in dB
+	 */
+	void setPsnr(double psnr);
+
+	/**
+	 * Writes everything recorded so far as a JSON object.
+	 * \param os the stream to write to
+	 * \param success whether the operation succeeded
+	 */
+	void writeJson(std::ostream &os, bool success);
+private:
+	std::string operation_;
+	std::string input_;
+	std::string output_;
+	Clock::time_point start_;
+	uint64_t startAllocations_;
+	uint32_t frames_;
+	uint32_t width_;
+	uint32_t height_;
+	uint32_t depth_;
+	double psnr_;
+	std::atomic<uint64_t> stageNanoseconds_[static_cast<int>(Stage::Count)];
+	std::atomic<uint64_t> stageCalls_[static_cast<int>(Stage::Count)];
+	std::mutex mutex_;
+	std::vector<FrameStats> frameStats_;
+};
+
+/**
+ * Counts an allocation made by the calling thread. The FlicTool executables
+ * call this from their replacement of operator new, programs embedding the
+ * library that don't are reported as making no allocations.
+ */
+void countAllocation();
+
+/**
+ * Starts adding up the allocations of every thread for \code totalAllocations \endcode, which a Stats does when it
+ * is created. Until then, each thread only counts its own allocations.
+ */
+void countTotalAllocations();
+
+/**
+ * \returns the number of allocations the calling thread has made
+ */
+uint64_t threadAllocations();
+
+/**
+ * \returns the number of allocations every thread has made since \code countTotalAllocations \endcode was first called
+ */
+uint64_t totalAllocations();
+
+/**
+ * \returns the largest amount of memory the process has had resident so far in bytes, or 0 if it isn't known
+ */
+uint64_t peakResidentBytes();
+
+#endif // FLICTOOL_STATS_H
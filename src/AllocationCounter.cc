@@ -0,0 +1,37 @@
+#include <cstdlib>
+#include <new>
+
+#include <FlicTool/Stats.h>
+
+// Every allocation goes through these, so that --stats and the benchmark can
+// report how many allocations each frame takes. They are linked into the
+// executables rather than the library, so that programs embedding the
+// library keep their own operator new.
+void *operator new(size_t size) {
+	countAllocation();
+	void *p = std::malloc(size > 0 ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	std::free(p);
+}
@@ -0,0 +1,239 @@
+#include <FlicTool/Batch.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <regex>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	bool hasFrames(const fs::path &directory) {
+		std::regex frameFilter("frame[0-9]{4}.bmp");
+		fs::directory_iterator endIter;
+		for (fs::directory_iterator iter(directory); iter != endIter; ++iter) {
+			if (fs::is_regular_file(iter->status()) && std::regex_match(iter->path().filename().string(), frameFilter)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool isFlicFile(const fs::path &path) {
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension == ".flh";
+	}
+
+	bool isEmptyDirectory(const fs::path &directory) {
+		fs::directory_iterator endIter;
+		for (fs::directory_iterator iter(directory); iter != endIter; ++iter) {
+			if (fs::is_regular_file(iter->status())) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const char *statusName(BatchStatus status) {
+		switch (status) {
+		case BatchStatus::Done:
+			return "done";
+		case BatchStatus::Skipped:
+			return "skipped";
+		default:
+			return "FAILED";
+		}
+	}
+}
+
+bool Batch::readManifest(const std::string &path) {
+	std::ifstream ifs(path);
+	if (!ifs.is_open()) {
+		std::cerr << "Error: Unable to open manifest \"" << path << "\".\n";
+		return false;
+	}
+	fs::path base = fs::path(path).parent_path();
+	std::string line;
+	while (std::getline(ifs, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (line.empty() || line[0] == '#') continue;
+
+		size_t tab = line.find('\t');
+		fs::path input = line.substr(0, tab);
+		fs::path output = tab != std::string::npos ? line.substr(tab + 1) : std::string();
+		if (input.is_relative()) {
+			input = base / input;
+		}
+		if (!output.empty() && output.is_relative()) {
+			output = base / output;
+		}
+		add(input.string(), output.string());
+	}
+	return true;
+}
+
+bool Batch::scan(const std::string &root) {
+	std::vector<fs::path> folders, flics;
+	try {
+		if (hasFrames(root)) {
+			folders.push_back(root);
+		}
+		fs::recursive_directory_iterator endIter;
+		for (fs::recursive_directory_iterator iter(root); iter != endIter; ++iter) {
+			if (fs::is_directory(iter->status())) {
+				if (hasFrames(iter->path())) {
+					folders.push_back(iter->path());
+				}
+			} else if (fs::is_regular_file(iter->status()) && isFlicFile(iter->path())) {
+				flics.push_back(iter->path());
+			}
+		}
+	} catch (fs::filesystem_error &e) {
+		std::cerr << "Error: Unable to scan \"" << root << "\": " << e.what() << "\n";
+		return false;
+	}
+
+	// The iterator doesn't return the files in any particular order, but the
+	// jobs should be listed the same way every time
+	std::sort(folders.begin(), folders.end());
+	std::sort(flics.begin(), flics.end());
+	for (const auto &folder : folders) {
+		add(folder.string(), "");
+	}
+	for (const auto &flic : flics) {
+		// A folder and a file of the same name would otherwise be written
+		// by two jobs at once
+		if (std::binary_search(folders.begin(), folders.end(), flic.parent_path() / flic.stem())) continue;
+		add(flic.string(), "");
+	}
+	return true;
+}
+
+void Batch::add(const std::string &input, const std::string &output) {
+	BatchJob job;
+	job.compiling = fs::is_directory(input);
+	job.input = input;
+	job.output = output;
+	if (job.output.empty()) {
+		// Unlike a single compile, many jobs can't share a default output
+		// name, so the output is named after the input instead
+		fs::path path(input);
+		if (job.compiling) {
+			job.output = path.string() + ".flh";
+		} else {
+			job.output = (path.parent_path() / path.stem()).string();
+		}
+	}
+	jobs_.push_back(job);
+}
+
+const std::vector<BatchJob> &Batch::jobs() const {
+	return jobs_;
+}
+
+bool Batch::run(const BatchOptions &options) {
+	uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t threads = options.jobs > 0 ? options.jobs : hardwareThreads;
+	threads = std::max<uint32_t>(1, std::min<size_t>(threads, jobs_.size()));
+	// When there are fewer jobs than threads, the spare threads go to the
+	// jobs themselves
+	uint32_t threadsPerJob = std::max(1u, (options.jobs > 0 ? options.jobs : hardwareThreads) / threads);
+
+	std::cout << "Running " << jobs_.size() << " jobs on " << threads << " threads.\n";
+	std::vector<BatchResult> results(jobs_.size());
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> completed(0);
+	std::mutex mutex;
+	std::vector<std::thread> workers;
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&]() {
+			for (size_t i = next++; i < jobs_.size(); i = next++) {
+				results[i] = runJob(jobs_[i], options, threadsPerJob);
+				size_t done = ++completed;
+				std::lock_guard<std::mutex> lock(mutex);
+				std::cout << "[" << done << "/" << jobs_.size() << "] " << statusName(results[i].status) << ": " << jobs_[i].input << "\n";
+			}
+		});
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+	std::cout << "\nSummary:\n";
+	uint32_t counts[3] = { 0 };
+	for (size_t i = 0; i < jobs_.size(); ++i) {
+		const BatchResult &result = results[i];
+		++counts[static_cast<int>(result.status)];
+		std::cout << std::left << std::setw(8) << statusName(result.status) << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(8) << result.seconds << "s  " << (jobs_[i].compiling ? "compile " : "decompile ")
+			<< "\"" << jobs_[i].input << "\" > \"" << jobs_[i].output << "\"";
+		if (!result.note.empty()) {
+			std::cout << " (" << result.note << ")";
+		}
+		std::cout << "\n";
+	}
+	std::cout << counts[static_cast<int>(BatchStatus::Done)] << " done, "
+		<< counts[static_cast<int>(BatchStatus::Skipped)] << " skipped, "
+		<< counts[static_cast<int>(BatchStatus::Failed)] << " failed.\n";
+	return counts[static_cast<int>(BatchStatus::Failed)] == 0;
+}
+
+BatchResult Batch::runJob(const BatchJob &job, const BatchOptions &options, uint32_t threads) {
+	auto start = std::chrono::steady_clock::now();
+	BatchResult result;
+	result.status = BatchStatus::Failed;
+	result.seconds = 0;
+
+	try {
+		bool exists = false;
+		if (!fs::exists(job.input)) {
+			result.note = "input does not exist";
+		} else if (job.compiling) {
+			exists = fs::exists(job.output);
+		} else {
+			exists = fs::exists(job.output) && !(fs::is_directory(job.output) && isEmptyDirectory(job.output));
+		}
+		if (exists && options.overwrite == OverwritePolicy::Skip) {
+			result.status = BatchStatus::Skipped;
+			result.note = "output exists";
+		} else if (exists && options.overwrite == OverwritePolicy::Fail) {
+			result.note = "output exists";
+		} else if (result.note.empty()) {
+			Flic flic;
+			bool success;
+			if (job.compiling) {
+				CompileOptions compileOptions = options.compileOptions;
+				compileOptions.jobs = threads;
+				compileOptions.quiet = true;
+				fs::path parent = fs::path(job.output).parent_path();
+				if (!parent.empty() && !fs::is_directory(parent)) {
+					fs::create_directories(parent);
+				}
+				success = flic.compile(job.input, job.output, compileOptions);
+			} else {
+				DecompileOptions decompileOptions = options.decompileOptions;
+				decompileOptions.jobs = threads;
+				decompileOptions.quiet = true;
+				success = (fs::is_directory(job.output) || fs::create_directories(job.output))
+					&& flic.decompile(job.input, job.output, decompileOptions);
+			}
+			result.status = success ? BatchStatus::Done : BatchStatus::Failed;
+		}
+	} catch (fs::filesystem_error &e) {
+		result.status = BatchStatus::Failed;
+		result.note = e.what();
+	}
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
\ No newline at end of file
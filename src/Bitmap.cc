@@ -1,8 +1,10 @@
 #include <FlicTool/Bitmap.h>
+#include <FlicTool/MappedFile.h>
+#include <FlicTool/PixelConvert.h>
+#include <FlicTool/Stats.h>
 
 #include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 
 Bitmap::Bitmap() : pixels_(nullptr) {
@@ -12,8 +14,16 @@ Bitmap::Bitmap(uint8_t *pixels, int width, int height, int bpp) : pixels_(nullpt
 	create(pixels, width, height, bpp);
 }
 
+Bitmap::Bitmap(const std::shared_ptr<uint8_t> &pixels, int width, int height, int bpp) : pixels_(nullptr) {
+	create(pixels, width, height, bpp);
+}
+
 void Bitmap::create(uint8_t *pixels, int width, int height, int bpp) {
-	pixels_.reset(pixels);
+	create(std::shared_ptr<uint8_t>(pixels), width, height, bpp);
+}
+
+void Bitmap::create(const std::shared_ptr<uint8_t> &pixels, int width, int height, int bpp) {
+	pixels_ = pixels;
 
 	memset(&header_, 0, sizeof(header_));
 	header_.magic[0] = 'B';
@@ -35,15 +45,30 @@ void Bitmap::create(uint8_t *pixels, int width, int height, int bpp) {
 	infoHeader_.importantColors = 0;
 }
 
-bool Bitmap::load(const std::string &path) {
-	std::ifstream ifs(path, std::ios_base::binary);
-
-	if (!ifs.is_open()) {
+bool Bitmap::load(const std::string &path, bool dither, Stats *stats) {
+	Stats::Clock::time_point start;
+	if (stats) {
+		start = Stats::Clock::now();
+	}
+	// The whole file is mapped, so that 16-bit pixels can be used where they
+	// are and everything else is converted without reading it line by line
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->open(path)) {
 		return false;
 	}
+	const uint8_t *data = file->data();
+	size_t size = file->size();
 
-	ifs.read(reinterpret_cast<char*>(&header_), sizeof(header_));
-	ifs.read(reinterpret_cast<char*>(&infoHeader_), sizeof(infoHeader_));
+	if (size < sizeof(header_) + sizeof(infoHeader_)) {
+		std::cerr << "Error: \"" << path << "\" is too small to be a bitmap.\n";
+		return false;
+	}
+	memcpy(&header_, data, sizeof(header_));
+	memcpy(&infoHeader_, data + sizeof(header_), sizeof(infoHeader_));
+	if (header_.magic[0] != 'B' || header_.magic[1] != 'M') {
+		std::cerr << "Error: \"" << path << "\" is not a bitmap.\n";
+		return false;
+	}
 
 	uint32_t bitMask[4] = { 0 };
 	switch (infoHeader_.bpp) {
@@ -64,15 +89,28 @@ bool Bitmap::load(const std::string &path) {
 			std::cerr << "Error: Unsupported bit depth: " << infoHeader_.bpp << '\n';
 			return false;
 	}
-	
+
+	// The masks follow the info header, or are part of it in the newer
+	// versions of the header
+	const uint8_t *masks = data + sizeof(header_) + sizeof(infoHeader_);
 	switch (infoHeader_.compression) {
 	case BI_RGB:
 		break;
 	case BI_BITFIELDS:
-		for (int i=0; i<3; ++i) ifs.read(reinterpret_cast<char*>(&bitMask[2 - i]), 4);
+		if (size < sizeof(header_) + sizeof(infoHeader_) + 12) {
+			std::cerr << "Error: Bitmap ends before its bit masks.\n";
+			return false;
+		}
+		for (int i=0; i<3; ++i) memcpy(&bitMask[2 - i], masks + i * 4, 4);
 		break;
 	case BI_ALPHABITFIELDS:
-		for (int i=0; i<4; ++i) ifs.read(reinterpret_cast<char*>(&bitMask[3 - i]), 4);
+		if (size < sizeof(header_) + sizeof(infoHeader_) + 16) {
+			std::cerr << "Error: Bitmap ends before its bit masks.\n";
+			return false;
+		}
+		// The alpha mask comes after the red, green and blue masks
+		for (int i=0; i<3; ++i) memcpy(&bitMask[2 - i], masks + i * 4, 4);
+		memcpy(&bitMask[3], masks + 12, 4);
 		break;
 	default:
 		std::cerr << "Error: Unrecognized bitmap compression method.\n";
@@ -86,8 +124,14 @@ bool Bitmap::load(const std::string &path) {
 		break;
 	case 108: // BITMAPV4HEADER
 	case 124: { // BITMAPV5HEADER
+		// The color space follows all four masks, however many of them the
+		// compression method uses
+		if (size < sizeof(header_) + infoHeader_.infoHeaderSize) {
+			std::cerr << "Error: Bitmap ends before its header.\n";
+			return false;
+		}
 		char signature[5];
-		ifs.read(signature, 4);
+		memcpy(signature, data + sizeof(header_) + 56, 4);
 		signature[4] = 0;
 		if (strcmp(signature, "BGRs") != 0) {
 			std::cerr << "Error: Unsupported color space. Expected \"BGRs\", got \"" << signature << "\"\n";
@@ -99,24 +143,49 @@ bool Bitmap::load(const std::string &path) {
 		std::cerr << "Error: Unrecognized bitmap header type.\n";
 		return false;
 	}
-	
-	ifs.seekg(header_.pixelOffset);
-	
-	uint8_t *original = new uint8_t[infoHeader_.width * infoHeader_.height * (infoHeader_.bpp / 8)];
 
-	uint32_t pitch = infoHeader_.width * (infoHeader_.bpp / 8);
-	uint32_t padding = pitch % 4 == 0 ? 0 : (4 - pitch % 4);
-	for (uint32_t y = 0; y < infoHeader_.height; ++y) {
-		uint32_t offset = y * pitch;
-		ifs.read(reinterpret_cast<char*>(original + offset), pitch);
-		if (padding) ifs.seekg(padding, std::ios_base::cur);
+	// Negative heights mean the lines are stored from the top down, which
+	// Flic Animation files can't hold without flipping every frame
+	if (infoHeader_.width == 0 || infoHeader_.height == 0 || infoHeader_.width > 0x7fffffff || infoHeader_.height > 0x7fffffff) {
+		std::cerr << "Error: Unsupported bitmap dimensions.\n";
+		return false;
 	}
+	uint64_t pitch = static_cast<uint64_t>(infoHeader_.width) * (infoHeader_.bpp / 8);
+	uint64_t paddedPitch = (pitch + 3) & ~static_cast<uint64_t>(3);
+	// The padding after the last line is often left out
+	if (header_.pixelOffset > size || (size - header_.pixelOffset) / paddedPitch < infoHeader_.height - 1
+		|| size - header_.pixelOffset - paddedPitch * (infoHeader_.height - 1) < pitch) {
+		std::cerr << "Error: Bitmap ends before its pixels.\n";
+		return false;
+	}
+	const uint8_t *original = data + header_.pixelOffset;
 	
-	if (infoHeader_.bpp == 16) {
-		pixels_.reset(original);
+	// 16-bit pixels only need converting if their channels aren't laid out
+	// the way Flic Animation files store them
+	bool converted = infoHeader_.bpp != 16 || bitMask[0] != 0x1f || bitMask[1] != 0x3e0 || bitMask[2] != 0x7c00;
+	if (!converted && pitch == paddedPitch) {
+		// The bitmap shares the mapping, which stays open until the last
+		// copy of the bitmap is gone
+		pixels_ = std::shared_ptr<uint8_t>(file, const_cast<uint8_t*>(original));
+	} else if (!converted) {
+		uint8_t *pixels = new uint8_t[pitch * infoHeader_.height];
+		for (uint32_t y = 0; y < infoHeader_.height; ++y) {
+			memcpy(pixels + y * pitch, original + y * paddedPitch, pitch);
+		}
+		pixels_.reset(pixels, std::default_delete<uint8_t[]>());
 	} else {
-		pixels_.reset(downsamplePixels(original, infoHeader_.width, infoHeader_.height, infoHeader_.bpp, bitMask));
-		delete original;
+		if (stats) {
+			start = stats->record(Stage::Load, start);
+		}
+		pixels_.reset(downsamplePixels(original, infoHeader_.width, infoHeader_.height, paddedPitch, infoHeader_.bpp, bitMask, dither), std::default_delete<uint8_t[]>());
+		infoHeader_.bpp = 16;
+		if (stats) {
+			stats->record(Stage::Downsample, start);
+		}
+		return true;
+	}
+	if (stats) {
+		stats->record(Stage::Load, start);
 	}
 
 	return true;
@@ -167,35 +236,11 @@ const uint32_t Bitmap::height() const {
 	return infoHeader_.height;
 }
 
-uint8_t *Bitmap::downsamplePixels(uint8_t *original, uint32_t width, uint32_t height, uint32_t bpp, uint32_t *bitMask) {
-	std::cout << "Downsampling " << bpp << " to 16.\n";
-	uint32_t length = width * height;
-	uint8_t *result = new uint8_t[length * 2];
-	uint32_t stride = bpp / 8;
-	
-	uint32_t bitShift[4] = { 0 };
-	for (int i = 0; i < 4; ++i) {
-		if (bitMask[i] == 0) continue;
-		int n = 0;
-		for (uint32_t p = bitMask[i]; (p & 1) == 0; p >>= 1) ++n;
-		bitShift[i] = n;
-		std::cout << "Bitmask: " << std::hex << bitMask[i] << std::dec << ", Shift: " << n << std::endl;
+uint8_t *Bitmap::downsamplePixels(const uint8_t *original, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp, const uint32_t *bitMask, bool dither) {
+	uint8_t *result = new uint8_t[width * height * 2];
+	PixelConverter converter(bpp, bitMask, dither);
+	for (uint32_t y = 0; y < height; ++y) {
+		converter.convertLine(original + y * pitch, reinterpret_cast<uint16_t*>(result + y * width * 2), width, y);
 	}
-	
-	for (uint32_t i=0; i<length; ++i) {
-		uint32_t pixel = *(uint32_t*)(original + i * stride);
-		uint16_t newPixel = 0;
-		for (int j=0; j<3; ++j) {
-			float c = (pixel & bitMask[j]) >> bitShift[j];
-			int newC = round(c / (bitMask[j] >> bitShift[j]) * 31);
-			newPixel |= ((newC & 0x1f) << (j * 5));
-		}
-		*(uint16_t*)(result + i * 2) = newPixel;
-	}
-	
 	return result;
-}
-
-int Bitmap::round(float n) {
-	return static_cast<int>(n + 0.5f);
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <FlicTool/ChunkCache.h>
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include <FlicTool/Flic.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	// Every entry starts with this, followed by the size of the frame and
+	// the key it was stored under, so that truncated or misplaced files
+	// are never used
+	const char entryMagic[4] = { 'F', 'L', 'H', 'C' };
+
+	#pragma pack(push, 1)
+	struct EntryHeader {
+		char magic[4];
+		uint32_t size;
+		uint64_t high;
+		uint64_t low;
+	};
+	#pragma pack(pop)
+}
+
+std::string CacheKey::name() const {
+	std::ostringstream name;
+	name << std::hex << std::setfill('0') << std::setw(16) << high << std::setw(16) << low;
+	return name.str();
+}
+
+ChunkCache::ChunkCache() : instance_(0), stored_(0) {
+}
+
+bool ChunkCache::open(const std::string &directory) {
+	boost::system::error_code ec;
+	if (!fs::is_directory(directory, ec) && !fs::create_directories(directory, ec)) {
+		std::cerr << "Error: Unable to create cache directory \"" << directory << "\".\n";
+		return false;
+	}
+	directory_ = directory;
+	// Drawn once, since a random device may have to open a file for every
+	// number it produces
+	std::random_device random;
+	instance_ = (static_cast<uint64_t>(random()) << 32) | random();
+	return true;
+}
+
+bool ChunkCache::load(const CacheKey &key, std::vector<uint8_t> &buffer) const {
+	std::ifstream ifs((fs::path(directory_) / key.name()).string(), std::ios_base::binary);
+	if (!ifs.is_open()) {
+		return false;
+	}
+	EntryHeader header;
+	if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, entryMagic, sizeof(entryMagic)) != 0
+		|| header.high != key.high || header.low != key.low || header.size < sizeof(FlicFrameHeader)) {
+		return false;
+	}
+	size_t offset = buffer.size();
+	buffer.resize(offset + header.size);
+	FlicFrameHeader frameHeader;
+	if (!ifs.read(reinterpret_cast<char*>(buffer.data() + offset), header.size) || ifs.peek() != std::char_traits<char>::eof()) {
+		buffer.resize(offset);
+		return false;
+	}
+	memcpy(&frameHeader, buffer.data() + offset, sizeof(frameHeader));
+	if (frameHeader.magic != 0xf1fa || frameHeader.size != header.size) {
+		buffer.resize(offset);
+		return false;
+	}
+	return true;
+}
+
+void ChunkCache::store(const CacheKey &key, const uint8_t *data, size_t size) const {
+	// The entry is written under a name of its own and renamed once it is
+	// complete, so that nobody can read a half-written entry. The name is
+	// made unique by a random number drawn for this cache, which tells
+	// processes apart, and a count of the entries it has stored, which
+	// tells its threads apart
+	fs::path path = fs::path(directory_) / key.name();
+	std::ostringstream tempName;
+	tempName << key.name() << "." << std::hex << instance_ << "-" << stored_++ << ".tmp";
+	fs::path tempPath = fs::path(directory_) / tempName.str();
+	{
+		std::ofstream ofs(tempPath.string(), std::ios_base::binary);
+		EntryHeader header;
+		memcpy(header.magic, entryMagic, sizeof(entryMagic));
+		header.size = size;
+		header.high = key.high;
+		header.low = key.low;
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		ofs.write(reinterpret_cast<const char*>(data), size);
+		if (!ofs) {
+			ofs.close();
+			boost::system::error_code ec;
+			fs::remove(tempPath, ec);
+			return;
+		}
+	}
+	boost::system::error_code ec;
+	fs::rename(tempPath, path, ec);
+	if (ec) {
+		fs::remove(tempPath, ec);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "ChunkDecoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool readBrun(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels) {
+	int bytespp = header.depth / 8;
+	for (int y = 0; y < header.height; ++y) {
+		// The packet count is unreliable for wide lines, so the line is
+		// decoded until it is full instead
+		uint8_t packets;
+		cursor.read(packets);
+		int x = 0;
+		while (x < header.width) {
+			uint8_t *dest = pixels + ((header.height - y - 1) * header.width + x) * bytespp;
+			int8_t count;
+			if (!cursor.read(count) || count == 0) {
+				return false;
+			}
+			int n = count >= 0 ? count : -count;
+			const uint8_t *src = cursor.take(count >= 0 ? bytespp : n * bytespp);
+			if (!src || x + n > header.width) {
+				return false;
+			}
+			if (count >= 0) {
+				fillPixels(dest, src, n, bytespp);
+			} else {
+				memcpy(dest, src, n * bytespp);
+			}
+			x += n;
+		}
+	}
+	return true;
+}
+
+bool readCopy(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels) {
+	size_t pitch = header.width * (header.depth / 8);
+	const uint8_t *src = cursor.take(pitch * header.height);
+	if (!src) {
+		return false;
+	}
+	for (int y = 0; y < header.height; ++y) {
+		memcpy(pixels + (header.height - y - 1) * pitch, src + y * pitch, pitch);
+	}
+	return true;
+}
+
+bool readLc(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels) {
+	uint16_t lines;
+	if (!cursor.read(lines)) {
+		return false;
+	}
+	int j = 0, y = 0;
+	while (j < lines) {
+		int16_t lineSkip;
+		if (!cursor.read(lineSkip)) {
+			return false;
+		}
+		if (lineSkip < 0) {
+			y += -lineSkip;
+			continue;
+		}
+		if (y >= header.height || !readLine(cursor, header, pixels, y, lineSkip)) {
+			return false;
+		}
+		++y;
+		++j;
+	}
+	return true;
+}
+
+bool readFliLc(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels) {
+	uint16_t y, lines;
+	if (!cursor.read(y) || !cursor.read(lines) || y + lines > header.height) {
+		return false;
+	}
+	for (uint32_t j = 0; j < lines; ++j, ++y) {
+		uint8_t packets;
+		if (!cursor.read(packets) || !readLine(cursor, header, pixels, y, packets)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool readLine(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels, int y, int packets) {
+	int bytespp = header.depth / 8;
+	int x = 0;
+	for (int k = 0; k < packets; ++k) {
+		uint8_t pixelSkip;
+		int8_t count;
+		if (!cursor.read(pixelSkip) || !cursor.read(count)) {
+			return false;
+		}
+		x += pixelSkip;
+		uint8_t *dest = pixels + ((header.height - y - 1) * header.width + x) * bytespp;
+		int n = count < 0 ? -count : count;
+		const uint8_t *src = cursor.take(count < 0 ? bytespp : n * bytespp);
+		if (!src || x + n > header.width) {
+			return false;
+		}
+		if (count < 0) {
+			fillPixels(dest, src, n, bytespp);
+		} else {
+			memcpy(dest, src, n * bytespp);
+		}
+		x += n;
+	}
+	return true;
+}
+
+void fillPixels(uint8_t *dest, const uint8_t *pixel, uint32_t count, int bpp) {
+	if (count == 0) {
+		return;
+	}
+	// Copy the pixel once and keep doubling the filled area
+	memcpy(dest, pixel, bpp);
+	size_t filled = bpp;
+	size_t total = count * bpp;
+	while (filled < total) {
+		size_t n = std::min(filled, total - filled);
+		memcpy(dest + filled, dest, n);
+		filled += n;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef FLICTOOL_CHUNKDECODER_H
+#define FLICTOOL_CHUNKDECODER_H
+
+#include <cstdint>
+
+#include <FlicTool/ByteCursor.h>
+#include <FlicTool/Flic.h>
+
+// The functions that apply the pixel chunks of a frame to a frame buffer.
+// They are internal to the library and the benchmark, FlicReader is the
+// interface for everyone else. The frame buffer has the depth of the file
+// and is stored bottom-up like the frames.
+
+/**
+ * Reads a DTA_BRUN or FLI_BRUN chunk and updates the frame buffer.
+ * \param cursor the cursor over the chunk data
+ * \param header the header of the file
+ * \param pixels the frame buffer
+ * \returns false if the chunk data is invalid
+ */
+bool readBrun(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels);
+
+/**
+ * Reads a DTA_COPY or FLI_COPY chunk and replaces the frame buffer with its uncompressed pixels.
+ * \param cursor the cursor over the chunk data
+ * \param header the header of the file
+ * \param pixels the frame buffer
+ * \returns false if the chunk data is invalid
+ */
+bool readCopy(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels);
+
+/**
+ * Reads a DTA_LC chunk and updates the frame buffer.
+ * This function assumes that the frame buffer still holds the previous frame, which it updates in place.
+ * \param cursor the cursor over the chunk data
+ * \param header the header of the file
+ * \param pixels the frame buffer
+ * \returns false if the chunk data is invalid
+ */
+bool readLc(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels);
+
+/**
+ * Reads a FLI_LC chunk, the 8-bit version of DTA_LC, and updates the frame buffer.
+ * This function assumes that the frame buffer still holds the previous frame, which it updates in place.
+ * \param cursor the cursor over the chunk data
+ * \param header the header of the file
+ * \param pixels the frame buffer
+ * \returns false if the chunk data is invalid
+ */
+bool readFliLc(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels);
+
+/**
+ * Reads the delta packets of a single line of a DTA_LC or FLI_LC chunk and updates the line in the frame buffer.
+ * \param cursor the cursor over the chunk data, positioned at the first packet
+ * \param header the header of the file
+ * \param pixels the frame buffer
+ * \param y the line to update, counting from the top
+ * \param packets the number of packets of the line
+ * \returns false if the packets are invalid
+ */
+bool readLine(ByteCursor &cursor, const FlicHeader &header, uint8_t *pixels, int y, int packets);
+
+/**
+ * Fills a run of pixels with copies of a single pixel.
+ * \param dest pointer to the first pixel to fill
+ * \param pixel pointer to the pixel to repeat
+ * \param count the amount of pixels to fill
+ * \param bpp the number of bytes per pixel
+ */
+void fillPixels(uint8_t *dest, const uint8_t *pixel, uint32_t count, int bpp);
+
+#endif // FLICTOOL_CHUNKDECODER_H
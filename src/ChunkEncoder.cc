@@ -0,0 +1,524 @@
+#include "ChunkEncoder.h"
+
+#include <algorithm>
+
+#include <FlicTool/Bitmap.h>
+#include <FlicTool/LineDiff.h>
+#include <FlicTool/Palette.h>
+#include <FlicTool/Stats.h>
+
+uint32_t writeRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<uint8_t> &buffer) {
+	uint32_t packets = 0;
+	for (; count > 0; count -= maxPacketPixels) {
+		buffer.push_back(static_cast<uint8_t>(std::min(count, maxPacketPixels)));
+		buffer.insert(buffer.end(), data, data + bpp);
+		++packets;
+	}
+	return packets;
+}
+
+uint32_t writeCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<uint8_t> &buffer) {
+	uint32_t packets = 0;
+	for (; count > 0; count -= maxPacketPixels) {
+		int32_t n = std::min(count, maxPacketPixels);
+		buffer.push_back(static_cast<uint8_t>(-n));
+		buffer.insert(buffer.end(), data, data + n * bpp);
+		data += n * bpp;
+		++packets;
+	}
+	return packets;
+}
+
+uint32_t encodeRle(const uint8_t *data, const uint64_t *same, uint32_t width, uint8_t bpp, std::vector<uint8_t> &buffer) {
+	uint32_t packets = 0;
+	uint32_t x = 0;
+	while (x < width) {
+		// A run of equal pixels starts at the pixel before the first one
+		// that is equal to its predecessor. Everything before it is copied.
+		uint32_t runStart = findMaskBit(same, x + 1, width, true);
+		if (runStart >= width) {
+			packets += writeCopyPacket(data + x * bpp, width - x, bpp, buffer);
+			break;
+		}
+		--runStart;
+		if (runStart > x) {
+			packets += writeCopyPacket(data + x * bpp, runStart - x, bpp, buffer);
+		}
+		uint32_t runEnd = findMaskBit(same, runStart + 1, width, false);
+		packets += writeRepeatPacket(data + runStart * bpp, runEnd - runStart, bpp, buffer);
+		x = runEnd;
+	}
+	return packets;
+}
+
+uint32_t createBrun(const FlicHeader &header, const Bitmap &bmp, const CompileOptions &options, std::vector<uint8_t> &buffer, uint32_t *packets) {
+	FlicFrameHeader frameHeader = { 0 };
+	frameHeader.magic = 0xf1fa;
+	frameHeader.chunks = 1;
+	// We don't know the size of this frame yet so leave it blank for now
+	size_t frameOffset = buffer.size();
+	append(buffer, frameHeader);
+	FlicChunkHeader chunkHeader = { 0 };
+	chunkHeader.type = header.depth == 8 ? FlicChunkType::FLI_BRUN : FlicChunkType::FLI_DTA_BRUN;
+	// We don't know the size of the chunk either
+	size_t chunkOffset = buffer.size();
+	append(buffer, chunkHeader);
+
+	size_t pitch = header.width * (header.depth / 8);
+	std::vector<uint64_t> same(maskWords(header.width));
+	// Lines are too short to time every one of them through the stats, so
+	// the time of each stage is added up here first
+	Stats::Clock::duration diffTime(0), packetTime(0);
+	Stats::Clock::time_point start;
+	uint32_t totalPackets = 0;
+	for (int y = header.height - 1; y >= 0; --y) {
+		const uint8_t *line = bmp.pixels() + y * pitch;
+		if (options.stats) {
+			start = Stats::Clock::now();
+		}
+		diffLine(line, nullptr, header.width, header.depth / 8, nullptr, same.data());
+		if (options.stats) {
+			Stats::Clock::time_point now = Stats::Clock::now();
+			diffTime += now - start;
+			start = now;
+		}
+		// The packets are written straight after the packet count, which is
+		// filled in once the line has been encoded
+		size_t countOffset = buffer.size();
+		buffer.push_back(0);
+		uint32_t packetCount = 0;
+		if (!options.optimal) {
+			packetCount = encodeRle(line, same.data(), header.width, header.depth / 8, buffer);
+		}
+		if (options.optimal || packetCount > maxLinePackets) {
+			// Lines with too many packets for the packet count are encoded
+			// again with the optimal encoder, which keeps within the limit
+			// for every width the compiler accepts, see maxLineWidth
+			buffer.resize(countOffset + 1);
+			packetCount = encodeLineOptimal(line, nullptr, same.data(), header.width, header.depth / 8, buffer);
+		}
+		buffer[countOffset] = static_cast<uint8_t>(packetCount);
+		totalPackets += packetCount;
+		if (options.stats) {
+			packetTime += Stats::Clock::now() - start;
+		}
+	}
+	if (options.stats) {
+		options.stats->add(Stage::Diff, diffTime);
+		options.stats->add(Stage::Packetize, packetTime);
+	}
+	if (packets) {
+		*packets = totalPackets;
+	}
+
+	// Now we need to go back to the fields we didn't know the values of before and fill them in
+	uint32_t chunkSize = buffer.size() - chunkOffset;
+	patch(buffer, chunkOffset, chunkSize);
+	uint32_t frameSize = buffer.size() - frameOffset;
+	patch(buffer, frameOffset, frameSize);
+
+	return frameSize;
+}
+
+uint32_t createCopy(const FlicHeader &header, const Bitmap &bmp, std::vector<uint8_t> &buffer) {
+	// The pixels are stored as they are, so all sizes are known up front
+	size_t pitch = header.width * (header.depth / 8);
+	FlicChunkHeader chunkHeader = { 0 };
+	chunkHeader.type = header.depth == 8 ? FlicChunkType::FLI_COPY : FlicChunkType::FLI_DTA_COPY;
+	chunkHeader.size = sizeof(chunkHeader) + pitch * header.height;
+	FlicFrameHeader frameHeader = { 0 };
+	frameHeader.magic = 0xf1fa;
+	frameHeader.chunks = 1;
+	frameHeader.size = sizeof(frameHeader) + chunkHeader.size;
+	append(buffer, frameHeader);
+	append(buffer, chunkHeader);
+	for (int y = header.height - 1; y >= 0; --y) {
+		const uint8_t *line = bmp.pixels() + y * pitch;
+		buffer.insert(buffer.end(), line, line + pitch);
+	}
+	return frameHeader.size;
+}
+
+uint32_t createEmptyLc(const FlicHeader &header, std::vector<uint8_t> &buffer) {
+	// A FLI_LC chunk starts with the number of lines to skip as well
+	bool palettized = header.depth == 8;
+	FlicChunkHeader chunkHeader = { 0 };
+	chunkHeader.type = palettized ? FlicChunkType::FLI_LC : FlicChunkType::FLI_DTA_LC;
+	chunkHeader.size = sizeof(chunkHeader) + sizeof(uint16_t) * (palettized ? 2 : 1);
+	FlicFrameHeader frameHeader = { 0 };
+	frameHeader.magic = 0xf1fa;
+	frameHeader.chunks = 1;
+	frameHeader.size = sizeof(frameHeader) + chunkHeader.size;
+	append(buffer, frameHeader);
+	append(buffer, chunkHeader);
+	if (palettized) {
+		append(buffer, uint16_t(0));
+	}
+	append(buffer, uint16_t(0));
+	return frameHeader.size;
+}
+
+uint32_t insertColor(const Palette &palette, size_t frameOffset, std::vector<uint8_t> &buffer) {
+	// A single packet sets every color, starting at the first. FLI_COLOR
+	// colors have 6 bits per channel
+	const std::vector<uint16_t> &colors = palette.colors();
+	std::vector<uint8_t> chunk;
+	FlicChunkHeader chunkHeader = { 0 };
+	chunkHeader.type = FlicChunkType::FLI_COLOR;
+	chunkHeader.size = sizeof(chunkHeader) + sizeof(uint16_t) + 2 + colors.size() * 3;
+	append(chunk, chunkHeader);
+	append(chunk, uint16_t(1));
+	chunk.push_back(0);
+	chunk.push_back(static_cast<uint8_t>(colors.size()));
+	for (uint16_t color : colors) {
+		for (int c = 2; c >= 0; --c) {
+			uint8_t value = (color >> (c * 5)) & 0x1f;
+			chunk.push_back(static_cast<uint8_t>((value << 1) | (value >> 4)));
+		}
+	}
+	buffer.insert(buffer.begin() + frameOffset + sizeof(FlicFrameHeader), chunk.begin(), chunk.end());
+
+	FlicFrameHeader frameHeader;
+	memcpy(&frameHeader, buffer.data() + frameOffset, sizeof(frameHeader));
+	frameHeader.size += chunk.size();
+	++frameHeader.chunks;
+	patch(buffer, frameOffset, frameHeader);
+	return frameHeader.size;
+}
+
+uint32_t writeDeltaRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint32_t pixelSkip, std::vector<uint8_t> &buffer) {
+	uint32_t packets = writeSkipPackets(pixelSkip, buffer);
+	for (; count > 0; count -= maxPacketPixels) {
+		buffer.push_back(static_cast<uint8_t>(pixelSkip));
+		buffer.push_back(static_cast<uint8_t>(-std::min(count, maxPacketPixels)));
+		buffer.insert(buffer.end(), data, data + bpp);
+		pixelSkip = 0;
+		++packets;
+	}
+	return packets;
+}
+uint32_t writeDeltaCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint32_t pixelSkip, std::vector<uint8_t> &buffer) {
+	uint32_t packets = writeSkipPackets(pixelSkip, buffer);
+	for (; count > 0; count -= maxPacketPixels) {
+		int32_t n = std::min(count, maxPacketPixels);
+		buffer.push_back(static_cast<uint8_t>(pixelSkip));
+		buffer.push_back(static_cast<uint8_t>(n));
+		buffer.insert(buffer.end(), data, data + n * bpp);
+		data += n * bpp;
+		pixelSkip = 0;
+		++packets;
+	}
+	return packets;
+}
+
+uint32_t writeSkipPackets(uint32_t &pixelSkip, std::vector<uint8_t> &buffer) {
+	// A skip that doesn't fit in a packet is split off into empty copy packets
+	uint32_t packets = 0;
+	while (pixelSkip > maxPixelSkip) {
+		buffer.push_back(static_cast<uint8_t>(maxPixelSkip));
+		buffer.push_back(0);
+		pixelSkip -= maxPixelSkip;
+		++packets;
+	}
+	return packets;
+}
+
+void getSubChunks(const uint8_t *data, const uint64_t *changed, uint32_t width, uint8_t bpp, std::vector<SubChunk> &subChunks) {
+	uint32_t lastEnd = 0;
+	uint32_t x = findMaskBit(changed, 0, width, true);
+	while (x < width) {
+		// Every run of updated pixels becomes a sub-chunk, which skips the
+		// pixels between it and the previous sub-chunk
+		uint32_t end = findMaskBit(changed, x, width, false);
+		SubChunk subChunk;
+		subChunk.pixelSkip = x - lastEnd;
+		subChunk.start = data + x * bpp;
+		subChunk.x = x;
+		subChunk.length = end - x;
+		subChunks.push_back(subChunk);
+		lastEnd = end;
+		x = findMaskBit(changed, end, width, true);
+	}
+}
+
+uint32_t encodeDeltaRle(const std::vector<SubChunk> &subChunks, const uint64_t *same, uint8_t bpp, std::vector<uint8_t> &buffer) {
+	uint32_t packets = 0;
+	for (const auto &subChunk : subChunks) {
+		// Runs are found the same way as in encodeRle, except that the first
+		// pixel of the sub-chunk can't continue a run from outside of it
+		uint32_t pixelSkip = subChunk.pixelSkip;
+		uint32_t end = subChunk.x + subChunk.length;
+		uint32_t x = subChunk.x;
+		while (x < end) {
+			uint32_t runStart = findMaskBit(same, x + 1, end, true);
+			if (runStart >= end) {
+				packets += writeDeltaCopyPacket(subChunk.start + (x - subChunk.x) * bpp, end - x, bpp, pixelSkip, buffer);
+				break;
+			}
+			--runStart;
+			if (runStart > x) {
+				packets += writeDeltaCopyPacket(subChunk.start + (x - subChunk.x) * bpp, runStart - x, bpp, pixelSkip, buffer);
+				pixelSkip = 0;
+			}
+			uint32_t runEnd = findMaskBit(same, runStart + 1, end, false);
+			packets += writeDeltaRepeatPacket(subChunk.start + (runStart - subChunk.x) * bpp, runEnd - runStart, bpp, pixelSkip, buffer);
+			pixelSkip = 0;
+			x = runEnd;
+		}
+	}
+	return packets;
+}
+
+uint32_t encodeLineOptimal(const uint8_t *data, const uint64_t *changed, const uint64_t *same, uint32_t width, uint8_t bpp, std::vector<uint8_t> &buffer) {
+	// Every position x in the line has two costs: ended[x] is the cheapest
+	// way to encode the line up to x with a packet ending at x, and
+	// pending[x] is the cheapest way to get to x with any pixels since the
+	// last packet skipped. Skipping is only possible over unchanged pixels
+	// in DTA_LC lines, for DTA_BRUN lines both costs are the same.
+	// A copy packet from k to x costs pending[k] plus a header and the pixels,
+	// a repeat packet costs pending[k] plus a header and one pixel, but can
+	// only start within the run of equal pixels that ends at x. All windows
+	// only move forward, so their minimums are kept in monotonic queues,
+	// which makes the whole search linear in the width of the line.
+	// Costs are counted in 1/65536 bytes so that ties between equally big
+	// encodings go to the one with fewer packets. If the result still has too
+	// many packets for the packet count, every packet is penalized with extra
+	// bytes until it fits. Once a packet costs more than every byte of the
+	// line together, the result has the fewest packets possible, which only
+	// lines wider than maxLineWidth don't fit in.
+	struct Step {
+		uint32_t from;
+		uint32_t start;
+		bool repeat;
+	};
+	static thread_local std::vector<int64_t> ended, pending;
+	static thread_local std::vector<uint32_t> endedStart, pendingFrom, copyQueue, repeatQueue, skipQueue;
+	static thread_local std::vector<uint8_t> endedRepeat;
+	static thread_local std::vector<Step> steps;
+	ended.resize(width + 1);
+	pending.resize(width + 1);
+	endedStart.resize(width + 1);
+	endedRepeat.resize(width + 1);
+	pendingFrom.resize(width + 1);
+	copyQueue.resize(width + 1);
+	repeatQueue.resize(width + 1);
+	skipQueue.resize(width + 1);
+
+	const bool delta = changed != nullptr;
+	const int64_t byteCost = 1 << 16;
+	const int64_t headerSize = delta ? 2 : 1;
+	for (int64_t penalty = 0; ; penalty = penalty > 0 ? penalty * 2 : 1) {
+		const int64_t packetCost = 1 + penalty * byteCost;
+		const int64_t copyCost = packetCost + headerSize * byteCost;
+		const int64_t repeatCost = packetCost + (headerSize + bpp) * byteCost;
+		const int64_t pixelCost = bpp * byteCost;
+		size_t copyHead = 0, copyTail = 0, repeatHead = 0, repeatTail = 0, skipHead = 0, skipTail = 0;
+		uint32_t unchangedStart = 0;
+		for (uint32_t x = 0; x <= width; ++x) {
+			if (x == 0) {
+				ended[0] = 0;
+			} else {
+				uint32_t k = x - 1;
+				// The copy queue orders positions by pending cost minus the
+				// pixels up to them, since copying costs the same per pixel
+				int64_t copyKey = pending[k] - k * pixelCost;
+				while (copyTail > copyHead && pending[copyQueue[copyTail - 1]] - copyQueue[copyTail - 1] * pixelCost >= copyKey) --copyTail;
+				copyQueue[copyTail++] = k;
+				while (x - copyQueue[copyHead] > static_cast<uint32_t>(maxPacketPixels)) ++copyHead;
+
+				// A repeat can only start within the run of equal pixels
+				if (k == 0 || !testMaskBit(same, k)) {
+					repeatHead = repeatTail = 0;
+				}
+				while (repeatTail > repeatHead && pending[repeatQueue[repeatTail - 1]] >= pending[k]) --repeatTail;
+				repeatQueue[repeatTail++] = k;
+				while (x - repeatQueue[repeatHead] > static_cast<uint32_t>(maxPacketPixels)) ++repeatHead;
+
+				uint32_t copyStart = copyQueue[copyHead];
+				uint32_t repeatStart = repeatQueue[repeatHead];
+				int64_t copyTotal = pending[copyStart] + copyCost + (x - copyStart) * pixelCost;
+				int64_t repeatTotal = pending[repeatStart] + repeatCost;
+				if (repeatTotal <= copyTotal) {
+					ended[x] = repeatTotal;
+					endedStart[x] = repeatStart;
+					endedRepeat[x] = 1;
+				} else {
+					ended[x] = copyTotal;
+					endedStart[x] = copyStart;
+					endedRepeat[x] = 0;
+				}
+			}
+
+			if (!delta) {
+				pending[x] = ended[x];
+				pendingFrom[x] = x;
+				continue;
+			}
+			if (x == 0 || testMaskBit(changed, x - 1)) {
+				unchangedStart = x;
+				skipHead = skipTail = 0;
+			}
+			while (skipTail > skipHead && ended[skipQueue[skipTail - 1]] >= ended[x]) --skipTail;
+			skipQueue[skipTail++] = x;
+			while (x - skipQueue[skipHead] > maxPixelSkip) ++skipHead;
+			pending[x] = ended[skipQueue[skipHead]];
+			pendingFrom[x] = skipQueue[skipHead];
+			// Skipping further back than a packet allows needs empty packets
+			if (x - unchangedStart > maxPixelSkip) {
+				int64_t fillers = (x - unchangedStart - 1) / maxPixelSkip;
+				int64_t cost = ended[unchangedStart] + fillers * (packetCost + 2 * byteCost);
+				if (cost < pending[x]) {
+					pending[x] = cost;
+					pendingFrom[x] = unchangedStart;
+				}
+			}
+		}
+
+		// Unchanged pixels at the end of a DTA_LC line don't need to be skipped
+		uint32_t end = width;
+		if (delta) {
+			for (uint32_t x = unchangedStart; x < width; ++x) {
+				if (ended[x] < ended[end]) end = x;
+			}
+		}
+
+		steps.clear();
+		uint32_t packets = 0;
+		for (uint32_t x = end; x > 0;) {
+			Step step;
+			step.start = endedStart[x];
+			step.from = pendingFrom[step.start];
+			step.repeat = endedRepeat[x] != 0;
+			packets += 1 + (step.start - step.from > maxPixelSkip ? (step.start - step.from - 1) / maxPixelSkip : 0);
+			steps.push_back(step);
+			x = step.from;
+		}
+		if (packets > maxLinePackets && penalty <= static_cast<int64_t>(width) * (bpp + 4)) {
+			continue;
+		}
+
+		// The steps were found from the end of the line, and every packet
+		// ends where the skip of the one after it starts
+		packets = 0;
+		for (size_t i = steps.size(); i > 0; --i) {
+			const Step &step = steps[i - 1];
+			uint32_t stepEnd = i > 1 ? steps[i - 2].from : end;
+			const uint8_t *p = data + step.start * bpp;
+			int32_t count = stepEnd - step.start;
+			if (delta) {
+				uint32_t pixelSkip = step.start - step.from;
+				packets += step.repeat ? writeDeltaRepeatPacket(p, count, bpp, pixelSkip, buffer) : writeDeltaCopyPacket(p, count, bpp, pixelSkip, buffer);
+			} else {
+				packets += step.repeat ? writeRepeatPacket(p, count, bpp, buffer) : writeCopyPacket(p, count, bpp, buffer);
+			}
+		}
+		return packets;
+	}
+}
+
+uint32_t createLc(const FlicHeader &header, const SourceFrame &last, const SourceFrame &current, const CompileOptions &options, std::vector<uint8_t> &buffer, uint32_t *packets) {
+	FlicFrameHeader frameHeader = { 0 };
+	frameHeader.magic = 0xf1fa;
+	frameHeader.chunks = 1;
+	// We don't know the size of this frame yet so leave it blank for now
+	size_t frameOffset = buffer.size();
+	append(buffer, frameHeader);
+	// FLI_LC is the 8-bit version of DTA_LC. It starts with the first line
+	// to update, and the lines after it are updated up to the last changed
+	// one, with no packets for the unchanged lines in between
+	bool palettized = header.depth == 8;
+	FlicChunkHeader chunkHeader = { 0 };
+	chunkHeader.type = palettized ? FlicChunkType::FLI_LC : FlicChunkType::FLI_DTA_LC;
+	// We don't know the size of the chunk either
+	size_t chunkOffset = buffer.size();
+	append(buffer, chunkHeader);
+
+	// We don't know the number of lines to update yet, so we will leave a
+	// spot for the line count here
+	size_t firstLineOffset = buffer.size();
+	if (palettized) {
+		append(buffer, uint16_t(0));
+	}
+	size_t lineOffset = buffer.size();
+	append(buffer, int16_t(0));
+
+	size_t pitch = header.width * (header.depth / 8);
+	int16_t lineSkip = 0;
+	uint16_t lines = 0;
+	std::vector<SubChunk> subChunks;
+	std::vector<uint64_t> changed(maskWords(header.width)), same(maskWords(header.width));
+	bool hashed = last.hash.lines.size() == header.height && current.hash.lines.size() == header.height;
+	Stats::Clock::duration diffTime(0), packetTime(0);
+	Stats::Clock::time_point start;
+	uint32_t totalPackets = 0;
+	for (int y = header.height - 1; y >= 0; --y) {
+		const uint8_t *line = current.bitmap.pixels() + y * pitch;
+		const uint8_t *lastLine = last.bitmap.pixels() + y * pitch;
+		if (options.stats) {
+			start = Stats::Clock::now();
+		}
+		bool changedLine = !(hashed && last.hash.lines[y] == current.hash.lines[y]) &&
+			diffLine(line, lastLine, header.width, header.depth / 8, changed.data(), same.data());
+		if (options.stats) {
+			Stats::Clock::time_point now = Stats::Clock::now();
+			diffTime += now - start;
+			start = now;
+		}
+		if (!changedLine) {
+			// Line is exactly the same, skip it
+			++lineSkip;
+			continue;
+		} else {
+			if (palettized) {
+				if (lines == 0) {
+					patch(buffer, firstLineOffset, static_cast<uint16_t>(lineSkip));
+				} else {
+					buffer.insert(buffer.end(), lineSkip, 0);
+					lines += lineSkip;
+				}
+			} else if (lineSkip > 0) {
+				append(buffer, int16_t(-lineSkip));
+			}
+			size_t countOffset = buffer.size();
+			size_t countSize = palettized ? sizeof(uint8_t) : sizeof(uint16_t);
+			buffer.resize(countOffset + countSize);
+			uint32_t packetCount = 0;
+			if (!options.optimal) {
+				subChunks.clear();
+				getSubChunks(line, changed.data(), header.width, header.depth / 8, subChunks);
+				packetCount = encodeDeltaRle(subChunks, same.data(), header.depth / 8, buffer);
+			}
+			if (options.optimal || packetCount > maxLinePackets) {
+				buffer.resize(countOffset + countSize);
+				packetCount = encodeLineOptimal(line, changed.data(), same.data(), header.width, header.depth / 8, buffer);
+			}
+			if (palettized) {
+				buffer[countOffset] = static_cast<uint8_t>(packetCount);
+			} else {
+				patch(buffer, countOffset, static_cast<uint16_t>(packetCount));
+			}
+			++lines;
+			lineSkip = 0;
+			totalPackets += packetCount;
+			if (options.stats) {
+				packetTime += Stats::Clock::now() - start;
+			}
+		}
+	}
+	if (options.stats) {
+		options.stats->add(Stage::Diff, diffTime);
+		options.stats->add(Stage::Packetize, packetTime);
+	}
+	if (packets) {
+		*packets = totalPackets;
+	}
+
+	// Now we need to go back to the fields we didn't know the values of before and fill them in
+	patch(buffer, lineOffset, lines);
+	uint32_t chunkSize = buffer.size() - chunkOffset;
+	patch(buffer, chunkOffset, chunkSize);
+	uint32_t frameSize = buffer.size() - frameOffset;
+	patch(buffer, frameOffset, frameSize);
+
+	return frameSize;
+}
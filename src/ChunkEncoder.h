@@ -0,0 +1,188 @@
+#pragma once
+#ifndef FLICTOOL_CHUNKENCODER_H
+#define FLICTOOL_CHUNKENCODER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <FlicTool/Flic.h>
+
+class Palette;
+
+// The functions that turn frames into Flic chunks. They are internal to the
+// library and the benchmark, Flic is the interface for everyone else.
+
+// The count of a packet is a signed byte, the pixel skip of a DTA_LC
+// packet is an unsigned byte and the packet count of a DTA_BRUN line is
+// an unsigned byte
+const int32_t maxPacketPixels = 127;
+const uint32_t maxPixelSkip = 255;
+const uint32_t maxLinePackets = 255;
+
+// Even the encoding with the fewest packets needs a packet for every 127
+// pixels, so wider lines can't be stored in DTA_BRUN, FLI_BRUN or FLI_LC
+const uint32_t maxLineWidth = maxLinePackets * maxPacketPixels;
+
+template <typename T>
+void append(std::vector<uint8_t> &buffer, const T &value) {
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(&value);
+	buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+void patch(std::vector<uint8_t> &buffer, size_t offset, const T &value) {
+	memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+/**
+ * Writes a Flic Repeat Packet. Used in DTA_BRUN chunks.
+ * Runs longer than a packet can hold are split across several packets.
+ * \param data pointer to the pixel to repeat
+ * \param count the amount of times to repeat the pixel
+ * \param bpp the bit depth of the Flic Animation
+ * \param buffer the buffer to append the resulting packet to
+ * \returns the number of packets written
+ */
+uint32_t writeRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<uint8_t> &buffer);
+
+/**
+ * Writes a Flic Copy Packet. Used in DTA_BRUN chunks.
+ * Runs longer than a packet can hold are split across several packets.
+ * \param data pointer to the first pixel to copy
+ * \param count the amount of pixels to copy
+ * \param bpp the bit depth of the Flic Animation
+ * \param buffer the buffer to append the resulting packet to
+ * \returns the number of packets written
+ */
+uint32_t writeCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<uint8_t> &buffer);
+
+/**
+ * Writes a Flic Delta Repeat Packet. Used in DTA_LC chunks.
+ * Runs and skips longer than a packet can hold are split across several packets.
+ * \param data pointer to the pixel to repeat
+ * \param count the amount of times to repeat the pixel
+ * \param bpp the bit depth of the Flic Animation
+ * \param pixelSkip the amount of pixels to skip before this packet
+ * \param buffer the buffer to append the resulting packet to
+ * \returns the number of packets written
+ */
+uint32_t writeDeltaRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint32_t pixelSkip, std::vector<uint8_t> &buffer);
+
+/**
+ * Writes a Flic Delta Copy Packet. Used in DTA_LC chunks.
+ * Runs and skips longer than a packet can hold are split across several packets.
+ * \param data pointer to the first pixel to copy
+ * \param count the amount of pixels to copy
+ * \param bpp the bit depth of the Flic Animation
+ * \param pixelSkip the amount of pixels to skip before this packet
+ * \param buffer the buffer to append the resulting packet to
+ * \returns the number of packets written
+ */
+uint32_t writeDeltaCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint32_t pixelSkip, std::vector<uint8_t> &buffer);
+
+/**
+ * Writes empty DTA_LC packets until the remaining skip fits in a single packet.
+ * \param pixelSkip the amount of pixels to skip, reduced by the pixels skipped by the written packets
+ * \param buffer the buffer to append the resulting packets to
+ * \returns the number of packets written
+ */
+uint32_t writeSkipPackets(uint32_t &pixelSkip, std::vector<uint8_t> &buffer);
+
+/**
+ * Encodes the specified line of pixels as DTA_BRUN packets.
+ * \param data pointer to the first pixel in the line to encode
+ * \param same mask of the pixels that are equal to the pixel before them, see \code diffLine \endcode
+ * \param width the width of the line in pixels
+ * \param bpp the bit depth of the Flic Animation
+ * \param buffer the buffer to append the resulting packets to
+ * \returns the number of packets written
+ */
+uint32_t encodeRle(const uint8_t *data, const uint64_t *same, uint32_t width, uint8_t bpp, std::vector<uint8_t> &buffer);
+
+/**
+ * Splits the updated pixels of a line into runs, based on a mask from comparing the line to the previous frame.
+ * The resulting sub-chunks can then be encoded separately.
+ * \param data pointer to the first pixel in the line to encode
+ * \param changed mask of the pixels that differ from the previous frame, see \code diffLine \endcode
+ * \param width the width of the line in pixels
+ * \param bpp the bit depth of the Flic Animation
+ * \param subchunks the vector to append the resulting subchunks to
+ */
+void getSubChunks(const uint8_t *data, const uint64_t *changed, uint32_t width, uint8_t bpp, std::vector<SubChunk> &subChunks);
+
+/**
+ * Encodes the updated pixels of a line as DTA_LC packets.
+ * \param subChunks the sub-chunks of updated pixels found by \code getSubChunks \endcode
+ * \param same mask of the pixels that are equal to the pixel before them, see \code diffLine \endcode
+ * \param bpp the bit depth of the Flic Animation
+ * \param buffer the buffer to append the resulting packets to
+ * \returns the number of packets written
+ */
+uint32_t encodeDeltaRle(const std::vector<SubChunk> &subChunks, const uint64_t *same, uint8_t bpp, std::vector<uint8_t> &buffer);
+
+/**
+ * Encodes a line of pixels with the packets that take up the fewest bytes, preferring fewer packets
+ * between equally big encodings and keeping within the 255 packets a line can hold. Lines up to
+ * \code maxLineWidth \endcode pixels wide always fit, wider lines get the fewest packets possible.
+ * \param data pointer to the first pixel in the line to encode
+ * \param changed mask of the pixels that differ from the previous frame for DTA_LC packets, or nullptr for DTA_BRUN packets
+ * \param same mask of the pixels that are equal to the pixel before them, see \code diffLine \endcode
+ * \param width the width of the line in pixels
+ * \param bpp the bit depth of the Flic Animation
+ * \param buffer the buffer to append the resulting packets to
+ * \returns the number of packets written, which is only more than 255 for lines wider than \code maxLineWidth \endcode
+ */
+uint32_t encodeLineOptimal(const uint8_t *data, const uint64_t *changed, const uint64_t *same, uint32_t width, uint8_t bpp, std::vector<uint8_t> &buffer);
+
+/**
+ * Creates a DTA_BRUN chunk by RLE-encoding a bitmap file.
+ * \param header the header of the Flic Animation file being created
+ * \param bmp the bitmap to encode
+ * \param options settings controlling how the frame is encoded
+ * \param buffer the buffer to append the resulting frame to
+ * \param packets receives the number of packets in the chunk, unless it is nullptr
+ * \returns the size of the frame in bytes
+ */
+uint32_t createBrun(const FlicHeader &header, const Bitmap &bmp, const CompileOptions &options, std::vector<uint8_t> &buffer, uint32_t *packets = nullptr);
+
+/**
+ * Creates a DTA_LC chunk by comparing a bitmap file to the last frame and RLE-encoding the updated pixels.
+ * Lines whose hashes match the same line of the last frame are skipped without comparing their pixels.
+ * \param header the header of the Flic Animation file being created
+ * \param last the previous frame
+ * \param current the current frame
+ * \param options settings controlling how the frame is encoded
+ * \param buffer the buffer to append the resulting frame to
+ * \param packets receives the number of packets in the chunk, unless it is nullptr
+ * \returns the size of the frame in bytes
+ */
+uint32_t createLc(const FlicHeader &header, const SourceFrame &last, const SourceFrame &current, const CompileOptions &options, std::vector<uint8_t> &buffer, uint32_t *packets = nullptr);
+
+/**
+ * Creates a DTA_LC chunk that doesn't update any lines, which repeats the previous frame.
+ * \param header the header of the Flic Animation file being created
+ * \param buffer the buffer to append the resulting frame to
+ * \returns the size of the frame in bytes
+ */
+uint32_t createEmptyLc(const FlicHeader &header, std::vector<uint8_t> &buffer);
+
+/**
+ * Inserts a FLI_COLOR chunk holding every color of a palette as the first chunk of an encoded frame.
+ * \param palette the palette of the animation
+ * \param frameOffset the offset of the frame in the buffer
+ * \param buffer the buffer holding the frame
+ * \returns the new size of the frame in bytes
+ */
+uint32_t insertColor(const Palette &palette, size_t frameOffset, std::vector<uint8_t> &buffer);
+
+/**
+ * Creates a DTA_COPY chunk holding the uncompressed pixels of a bitmap file.
+ * \param header the header of the Flic Animation file being created
+ * \param bmp the bitmap to store
+ * \param buffer the buffer to append the resulting frame to
+ * \returns the size of the frame in bytes
+ */
+uint32_t createCopy(const FlicHeader &header, const Bitmap &bmp, std::vector<uint8_t> &buffer);
+
+#endif // FLICTOOL_CHUNKENCODER_H
@@ -1,20 +1,93 @@
 #include <FlicTool/Flic.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <regex>
 #include <sstream>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include <FlicTool/BoundedQueue.h>
+#include <FlicTool/FlicPlayer.h>
+#include <FlicTool/FlicReader.h>
+#include <FlicTool/FrameLoader.h>
+#include <FlicTool/LineDiff.h>
+#include <FlicTool/NearMatch.h>
+#include <FlicTool/Palette.h>
+
+#include "ChunkEncoder.h"
+
 namespace fs = boost::filesystem;
 
-void Flic::compile(const std::string &input, const std::string &output) {
-	std::cout << "Compiling \"" << input << "\" > \"" << output << "\"\n";
+namespace {
+	struct FrameTask {
+		uint32_t index;
+		SourceFrame previous;
+		SourceFrame current;
+	};
+
+	struct DecodedFrame {
+		uint32_t index;
+		std::vector<uint8_t> pixels;
+	};
+
+	// The smallest a DTA_BRUN frame could be, with every line made of the
+	// fewest possible repeat packets
+	size_t minBrunSize(const FlicHeader &header) {
+		size_t packets = (header.width + maxPacketPixels - 1) / maxPacketPixels;
+		return sizeof(FlicFrameHeader) + sizeof(FlicChunkHeader) + header.height * (1 + packets * (1 + header.depth / 8));
+	}
+
+	bool isKeyframe(uint32_t index, const CompileOptions &options) {
+		return index == 0 || (options.keyframeInterval > 0 && index % options.keyframeInterval == 0);
+	}
+
+	void recordFrame(Stats *stats, uint32_t index, const std::vector<uint8_t> &buffer, FrameEncoding encoding, int64_t packets, uint64_t allocations, Stats::Clock::time_point start) {
+		FrameStats frame;
+		frame.index = index;
+		// The palette that starts the keyframes of an 8-bit file says nothing
+		// about how the pixels are stored, so the chunk after it is reported
+		FlicChunkHeader chunkHeader;
+		size_t offset = sizeof(FlicFrameHeader);
+		memcpy(&chunkHeader, buffer.data() + offset, sizeof(chunkHeader));
+		if (chunkHeader.type == FLI_COLOR && offset + chunkHeader.size + sizeof(chunkHeader) <= buffer.size()) {
+			offset += chunkHeader.size;
+			memcpy(&chunkHeader, buffer.data() + offset, sizeof(chunkHeader));
+		}
+		frame.chunkType = chunkHeader.type;
+		frame.encoding = encoding == FrameEncoding::Duplicate ? "duplicate" : encoding == FrameEncoding::Cached ? "cached" : "encoded";
+		frame.bytes = buffer.size();
+		frame.packets = packets;
+		frame.allocations = threadAllocations() - allocations;
+		frame.seconds = std::chrono::duration<double>(Stats::Clock::now() - start).count();
+		stats->addFrame(frame);
+	}
+}
+
+bool Flic::compile(const std::string &input, const std::string &output, const CompileOptions &options) {
+	if (!options.quiet) {
+		std::cout << "Compiling \"" << input << "\" > \"" << output << "\"\n";
+	}
+
+	Stats *stats = options.stats;
+	Stats::Clock::time_point start = Stats::Clock::now();
 
-	// First, we need to find all the frames to compile and load their data
-	// Note: 16-bit bitmaps aren't very big, but let's load them lazily in the
-	// next version
+	// First, we need to find all the frames to compile. The frames themselves
+	// are loaded while encoding, so that only the frames which are currently
+	// being loaded or encoded are kept in memory
 	std::vector<std::string> frameFilenames;
 	std::regex frameFilter("frame[0-9]{4}.bmp");
 	fs::directory_iterator endIter;
@@ -28,440 +101,903 @@ void Flic::compile(const std::string &input, const std::string &output) {
 	}
 	if (frameFilenames.size() == 0) {
 		std::cerr << "Error: No frames found in input folder.\n";
-		return;
+		return false;
 	}
-	std::cout << "Found " << frameFilenames.size() << " frames in input folder.\n";
-	std::vector<Bitmap> bitmaps;
-	for (const auto &filename : frameFilenames) {
-		Bitmap bmp;
-		if (!bmp.load(filename)) {
-			std::cerr << "Error: Program can't continue due to an invalid frame.\n";
-			return;
-		}
-		bitmaps.push_back(bmp);
+	// The directory iterator doesn't guarantee any particular order, but the
+	// frame numbers are zero-padded so sorting the names sorts the frames
+	std::sort(frameFilenames.begin(), frameFilenames.end());
+	if (stats) {
+		stats->record(Stage::Scan, start);
+	}
+	if (!options.quiet) {
+		std::cout << "Found " << frameFilenames.size() << " frames in input folder.\n";
+	}
+
+	// The first frame determines the dimensions of the animation
+	SourceFrame first;
+	if (!first.bitmap.load(frameFilenames[0], options.dither, stats)) {
+		std::cerr << "Error: Program can't continue due to an invalid frame.\n";
+		return false;
 	}
 
 	// Create the header, but ignore the size field for now, since we haven't calculated it yet
 	FlicHeader header = { 0 };
 	header.magic = 0xaf43;
 	header.frames = frameFilenames.size();
-	header.width = bitmaps[0].width();
-	header.height = bitmaps[0].height();
+	header.width = first.bitmap.width();
+	header.height = first.bitmap.height();
 	header.depth = 16;
-	
-	std::ofstream ofs(output, std::ios_base::binary);
-	ofs.write(reinterpret_cast<char*>(&header), sizeof(header));
-
-	// We need to grab the size of the first frame since FLH files have some
-	// weird offset to the end of the first frame in the header
-	uint32_t frameSize = createBrun(header, bitmaps[0], ofs);
-	int64_t cur = ofs.tellp();
-	ofs.seekp(0x50, std::ios_base::beg);
-	uint32_t magic80 = 0x80;
-	uint32_t unknownValue = frameSize + 0x80;
-	ofs.write(reinterpret_cast<char*>(&magic80), 4);
-	ofs.write(reinterpret_cast<char*>(&unknownValue), 4);
-	ofs.seekp(cur, std::ios_base::beg);
-	progressBar(1, header.frames, 50);
-	for (int i = 1; i < header.frames; ++i) {
-		createLc(header, bitmaps[i-1], bitmaps[i], ofs);
-		progressBar((i + 1), header.frames, 50);
-	}
-	std::cout << "\n";
 
-	// With the file completed we can grab the size and write it to the header
-	int32_t size = (int32_t)ofs.tellp();
-	ofs.seekp(0, std::ios_base::beg);
-	ofs.write(reinterpret_cast<char*>(&size), 4);
+	// The frames after the first are loaded on their own threads, so that
+	// the encoder doesn't have to wait for the storage
+	uint32_t loaders = options.loaders > 0 ? options.loaders : std::max(1u, std::thread::hardware_concurrency());
+	return encodeAnimation(header, first, loaders, [&](uint32_t index, Bitmap &bmp) {
+		return loadBitmap(header, frameFilenames[index], options, bmp);
+	}, output, options);
 }
 
-void Flic::writeRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<Packet> &packets) {
-	Packet packet;
-	packet.size = bpp + 1;
-	packet.data = new char[packet.size];
-	memcpy(packet.data + 1, data, bpp);
-	packet.data[0] = count;
-	packets.push_back(packet);
-}
-void Flic::writeCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, std::vector<Packet> &packets) {
-	Packet packet;
-	packet.size = count * bpp + 1;
-	packet.data = new char[packet.size];
-	memcpy(packet.data + 1, data, count * bpp);
-	packet.data[0] = -count;
-	packets.push_back(packet);
-}
+bool Flic::encodeAnimation(FlicHeader header, SourceFrame &first, uint32_t loaders, const LoadFunction &load, const std::string &output, const CompileOptions &options) {
+	// The packet count of a line would overflow
+	if (header.width > maxLineWidth) {
+		std::cerr << "Error: Frames wider than " << maxLineWidth << " pixels can't be stored in a Flic file.\n";
+		return false;
+	}
+	Stats *stats = options.stats;
+	uint32_t prefetch = options.prefetch > 0 ? options.prefetch : loaders * 2;
 
-void Flic::encodeRle(const uint8_t *data, uint32_t width, uint8_t bpp, std::vector<Packet> &packets) {
-	uint32_t bytesEncoded = 0;
-	uint32_t offset = 0;
-	const uint8_t *last = nullptr, *last2 = nullptr;
-	bool repeat = false;
-	int count = 0;
-	const int repeatBuffer = 1;
-	while (bytesEncoded < width * bpp) {
-		if (offset >= width * bpp) {
-			// Reached end of line but haven't encoded all of it yet.
-			if (repeat) {
-				writeRepeatPacket(data + bytesEncoded, count, bpp, packets);
-			} else {
-				writeCopyPacket(data + bytesEncoded, count, bpp, packets);
+	// The first frame of a palettized file already needs the palette, so
+	// every frame is read once to count its colors before encoding starts
+	Palette palette;
+	const Palette *framePalette = nullptr;
+	if (options.palettized) {
+		if (!options.quiet) {
+			std::cout << "Building palette.\n";
+		}
+		palette.addPixels(first.bitmap.pixels(), header.width * header.height);
+		FrameLoader counter(1, header.frames, loaders, prefetch, [&](uint32_t index, SourceFrame &frame) {
+			return load(index, frame.bitmap);
+		});
+		SourceFrame frame;
+		for (uint32_t i = 1; i < header.frames; ++i) {
+			if (!counter.next(frame)) {
+				std::cerr << "Error: Program can't continue due to an invalid frame.\n";
+				return false;
 			}
-			break;
+			palette.addPixels(frame.bitmap.pixels(), header.width * header.height);
+		}
+		palette.build();
+		header.depth = 8;
+		framePalette = &palette;
+	}
+	// With a tolerance, every frame depends on what the frame before it was
+	// stored as, so the loaders only load the frames and the filter runs
+	// here, in order
+	bool filtered = options.tolerance > 0;
+	NearMatchFilter filter(header.width, header.height, options.tolerance);
+	if (filtered) {
+		filterFrame(header, framePalette, options, filter, true, first);
+	} else {
+		prepareFrame(header, framePalette, options, first);
+	}
+	if (stats) {
+		stats->setAnimation(header.frames, header.width, header.height, header.depth);
+	}
+
+	// Pipes and standard output can't go back to fill in the size of the
+	// file, so the file is assembled in memory instead and written in one
+	// go once its size is known
+	bool toStdout = output == "-";
+	bool seekable = !toStdout && !(fs::exists(output) && !fs::is_regular_file(output));
+	std::ofstream ofs;
+	if (!toStdout) {
+		ofs.open(output, std::ios_base::binary);
+		if (!ofs.is_open()) {
+			std::cerr << "Error: Unable to open output file \"" << output << "\".\n";
+			return false;
+		}
+	}
+	std::vector<uint8_t> file;
+	std::ostream *os = seekable ? &ofs : nullptr;
+
+	uint32_t jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+	jobs = std::min<uint32_t>(jobs, header.frames);
+
+	ChunkCache cacheDirectory;
+	const ChunkCache *cache = nullptr;
+	if (!options.cacheDirectory.empty()) {
+		if (!cacheDirectory.open(options.cacheDirectory)) {
+			return false;
+		}
+		cache = &cacheDirectory;
+	}
+
+	FrameLoader loader(1, header.frames, loaders, prefetch, [&](uint32_t index, SourceFrame &frame) {
+		if (!load(index, frame.bitmap)) {
+			return false;
+		}
+		if (!filtered) {
+			prepareFrame(header, framePalette, options, frame);
+		}
+		return true;
+	});
+
+	bool success = true;
+	std::atomic<uint32_t> duplicates(0), cached(0);
+	if (jobs <= 1) {
+		// Encode and write each frame before moving on to the next one
+		SourceFrame previous;
+		std::vector<uint8_t> buffer;
+		for (uint32_t i = 0; i < header.frames; ++i) {
+			SourceFrame current;
+			if (i == 0) {
+				std::swap(current, first);
+			} else if (!loader.next(current)) {
+				success = false;
+				break;
+			} else if (filtered) {
+				filterFrame(header, framePalette, options, filter, isKeyframe(i, options), current);
+			}
+			buffer.clear();
+			FrameEncoding encoding;
+			int64_t packets;
+			uint64_t allocations = threadAllocations();
+			Stats::Clock::time_point start = Stats::Clock::now();
+			encodeFrame(header, isKeyframe(i, options) ? nullptr : &previous, current, options, cache, framePalette, buffer, encoding, &packets);
+			duplicates += encoding == FrameEncoding::Duplicate;
+			cached += encoding == FrameEncoding::Cached;
+			if (stats) {
+				recordFrame(stats, i, buffer, encoding, packets, allocations, start);
+				start = Stats::Clock::now();
+			}
+			writeFrame(header, i, buffer, os, file);
+			if (stats) {
+				stats->record(Stage::Write, start);
+			}
+			previous = current;
+			if (!options.quiet) {
+				progressBar((i + 1), header.frames, 50);
+			}
+		}
+	} else {
+		// This thread takes the loaded frames in order and hands each pair of
+		// consecutive frames to a pool of workers, which encode every frame
+		// into its own buffer. A writer thread then appends the finished
+		// buffers to the file in order. The task queue and the window of
+		// frames the workers may run ahead of the writer keep the number of
+		// frames in memory bounded. Written buffers are handed back to the
+		// workers so that they can be reused for later frames.
+		BoundedQueue<FrameTask> tasks(jobs * 2);
+		std::map<uint32_t, std::vector<uint8_t>> finished;
+		std::vector<std::vector<uint8_t>> spare;
+		std::mutex mutex;
+		std::condition_variable cv;
+		uint32_t written = 0;
+		bool aborted = false;
+		const uint32_t window = jobs * 4;
+
+		std::vector<std::thread> workers;
+		for (uint32_t j = 0; j < jobs; ++j) {
+			workers.emplace_back([&]() {
+				FrameTask task;
+				std::vector<uint8_t> buffer;
+				while (tasks.pop(task)) {
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						cv.wait(lock, [&]() { return aborted || task.index < written + window; });
+						if (aborted) continue;
+						if (!spare.empty()) {
+							buffer.swap(spare.back());
+							spare.pop_back();
+						}
+					}
+					buffer.clear();
+					FrameEncoding encoding;
+					int64_t packets;
+					uint64_t allocations = threadAllocations();
+					Stats::Clock::time_point start = Stats::Clock::now();
+					encodeFrame(header, isKeyframe(task.index, options) ? nullptr : &task.previous, task.current, options, cache, framePalette, buffer, encoding, &packets);
+					duplicates += encoding == FrameEncoding::Duplicate;
+					cached += encoding == FrameEncoding::Cached;
+					if (stats) {
+						recordFrame(stats, task.index, buffer, encoding, packets, allocations, start);
+					}
+					uint32_t index = task.index;
+					// Release the frames as soon as possible
+					task = FrameTask();
+					std::lock_guard<std::mutex> lock(mutex);
+					finished[index].swap(buffer);
+					cv.notify_all();
+				}
+			});
 		}
-		const uint8_t *p = data + offset;
-		if (last && last2 && !repeat && memcmp(p, last, bpp) == 0) {
-			repeat = true;
-			if (count > repeatBuffer) {
-				count -= repeatBuffer;
-				writeCopyPacket(data + bytesEncoded, count, bpp, packets);
-				bytesEncoded += count * bpp;
-				count = repeatBuffer;
+		std::thread writer([&]() {
+			for (uint32_t i = 0; i < header.frames; ++i) {
+				std::vector<uint8_t> buffer;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait(lock, [&]() { return aborted || finished.count(i) > 0; });
+					if (aborted) return;
+					buffer.swap(finished[i]);
+					finished.erase(i);
+				}
+				Stats::Clock::time_point start = Stats::Clock::now();
+				writeFrame(header, i, buffer, os, file);
+				if (stats) {
+					stats->record(Stage::Write, start);
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					written = i + 1;
+					spare.push_back(std::move(buffer));
+					cv.notify_all();
+				}
+				if (!options.quiet) {
+					progressBar((i + 1), header.frames, 50);
+				}
 			}
-		} else if (last && repeat && memcmp(p, last, bpp) != 0) {
-			repeat = false;
-			writeRepeatPacket(data + bytesEncoded, count, bpp, packets);
-			bytesEncoded += count * bpp;
-			count = 0;
+		});
+
+		SourceFrame previous;
+		for (uint32_t i = 0; i < header.frames; ++i) {
+			FrameTask task;
+			task.index = i;
+			task.previous = previous;
+			if (i == 0) {
+				std::swap(task.current, first);
+			} else if (!loader.next(task.current)) {
+				success = false;
+				break;
+			} else if (filtered) {
+				filterFrame(header, framePalette, options, filter, isKeyframe(i, options), task.current);
+			}
+			previous = task.current;
+			tasks.push(std::move(task));
+		}
+		if (!success) {
+			std::lock_guard<std::mutex> lock(mutex);
+			aborted = true;
+			cv.notify_all();
 		}
-		last = p;
-		last2 = last;
-		offset += bpp;
-		++count;
+		tasks.close();
+		for (auto &worker : workers) {
+			worker.join();
+		}
+		writer.join();
+	}
+	if (!options.quiet) {
+		std::cout << "\n";
 	}
-}
 
-uint32_t Flic::createBrun(const FlicHeader &header, const Bitmap &bmp, std::ostream &os) {
-	FlicFrameHeader frameHeader = { 0 };
-	frameHeader.magic = 0xf1fa;
-	frameHeader.chunks = 1;
-	// We don't know the size of this frame yet so leave it blank for now
-	int32_t frameOffset = (int32_t)os.tellp();
-	os.write(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader));
-	FlicChunkHeader chunkHeader = { 0 };
-	chunkHeader.type = FlicChunkType::FLI_DTA_BRUN;
-	// We don't know the size of the chunk either
-	int32_t chunkOffset = (int32_t)os.tellp();
-	os.write(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader));
-
-	size_t pitch = header.width * (header.depth / 8);
-	for (int y = header.height - 1; y >= 0; --y) {
-		const uint8_t *line = bmp.pixels() + y * pitch;
-		std::vector<Packet> packets;
-		encodeRle(line, header.width, header.depth / 8, packets);
-		uint8_t packetCount = packets.size();
-		os.write(reinterpret_cast<char*>(&packetCount), 1);
-		for (const auto &packet : packets) {
-			os.write(packet.data, packet.size);
-			delete packet.data;
-		}
-	}
-
-	// Now we need to go back to the fields we didn't know the values of before and fill them in
-	int32_t frameEnd = (int32_t)os.tellp();
-	os.seekp(chunkOffset, std::ios_base::beg);
-	int32_t chunkSize = frameEnd - chunkOffset;
-	os.write(reinterpret_cast<char*>(&chunkSize), 4);
-	os.seekp(frameOffset, std::ios_base::beg);
-	int32_t frameSize = frameEnd - frameOffset;
-	os.write(reinterpret_cast<char*>(&frameSize), 4);
-	os.seekp(frameEnd, std::ios_base::beg);
+	if (!success) {
+		std::cerr << "Error: Program can't continue due to an invalid frame.\n";
+		if (seekable) {
+			ofs.close();
+			fs::remove(output);
+		}
+		return false;
+	}
 
-	return frameSize;
+	// With the file completed we can grab the size and write it to the header
+	bool written;
+	uint64_t fileSize = seekable ? static_cast<uint64_t>(ofs.tellp()) : file.size();
+	if (fileSize > std::numeric_limits<uint32_t>::max()) {
+		std::cerr << "Error: The animation is too large for the size field of a Flic file.\n";
+		if (seekable) {
+			ofs.close();
+			fs::remove(output);
+		}
+		return false;
+	}
+	uint32_t size = static_cast<uint32_t>(fileSize);
+	if (seekable) {
+		ofs.seekp(0, std::ios_base::beg);
+		ofs.write(reinterpret_cast<char*>(&size), 4);
+		ofs.close();
+		written = !ofs.fail();
+	} else {
+		memcpy(file.data(), &size, 4);
+		if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			std::cout.write(reinterpret_cast<const char*>(file.data()), file.size());
+			std::cout.flush();
+			written = !std::cout.fail();
+		} else {
+			ofs.write(reinterpret_cast<const char*>(file.data()), file.size());
+			ofs.close();
+			written = !ofs.fail();
+		}
+	}
+	if (!written) {
+		std::cerr << "Error: Writing output file \"" << output << "\" failed.\n";
+		return false;
+	}
+	if (filtered && stats) {
+		stats->setPsnr(filter.psnr());
+	}
+	if (!options.quiet) {
+		std::cout << "Deduplicated " << duplicates << " of " << header.frames << " frames.\n";
+		if (cache) {
+			std::cout << "Reused " << cached << " of " << header.frames << " frames from the cache.\n";
+		}
+		if (filtered) {
+			std::cout << "PSNR: " << std::fixed << std::setprecision(2) << filter.psnr() << " dB.\n";
+		}
+	}
+	return true;
 }
 
-void Flic::writeDeltaRepeatPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint8_t pixelSkip, std::vector<Packet> &packets) {
-	Packet packet;
-	packet.size = bpp + 2;
-	packet.data = new char[packet.size];
-	memcpy(packet.data + 2, data, bpp);
-	packet.data[0] = pixelSkip;
-	packet.data[1] = -count;
-	packets.push_back(packet);
+bool Flic::optimize(const std::string &input, const std::string &output, const CompileOptions &options) {
+	if (!options.quiet) {
+		std::cout << "Optimizing \"" << input << "\" > \"" << output << "\"\n";
+	}
+	FlicReader reader;
+	if (!reader.open(input)) {
+		return false;
+	}
+	const FlicHeader &source = reader.header();
+	if (source.frames == 0) {
+		std::cerr << "Error: The Flic file has no frames.\n";
+		return false;
+	}
+
+	FlicHeader header = { 0 };
+	header.magic = 0xaf43;
+	header.frames = source.frames;
+	header.width = source.width;
+	header.height = source.height;
+	header.depth = 16;
+	header.speed = source.speed;
+
+	// Frames are decoded straight into new frames for the encoder, instead
+	// of going through bitmap files. The reader decodes one frame after
+	// another, so there is a single loader, which decodes ahead of the
+	// encoder up to the prefetch depth
+	auto decode = [&](uint32_t index, Bitmap &bmp) {
+		Stats::Clock::time_point start = Stats::Clock::now();
+		if (!reader.decodeFrame(index)) {
+			return false;
+		}
+		uint8_t *pixels = new uint8_t[reader.frameSize()];
+		memcpy(pixels, reader.pixels(), reader.frameSize());
+		bmp.create(std::shared_ptr<uint8_t>(pixels, std::default_delete<uint8_t[]>()), header.width, header.height, 16);
+		if (options.stats) {
+			options.stats->record(Stage::Decode, start);
+		}
+		return true;
+	};
+	SourceFrame first;
+	if (!decode(0, first.bitmap)) {
+		return false;
+	}
+	return encodeAnimation(header, first, 1, decode, output, options);
 }
-void Flic::writeDeltaCopyPacket(const uint8_t *data, int32_t count, uint8_t bpp, uint8_t pixelSkip, std::vector<Packet> &packets) {
-	Packet packet;
-	packet.size = count * bpp + 2;
-	packet.data = new char[packet.size];
-	memcpy(packet.data + 2, data, count * bpp);
-	packet.data[0] = pixelSkip;
-	packet.data[1] = count;
-	packets.push_back(packet);
+
+bool Flic::loadBitmap(const FlicHeader &header, const std::string &filename, const CompileOptions &options, Bitmap &bmp) {
+	if (!bmp.load(filename, options.dither, options.stats)) {
+		return false;
+	}
+	if (bmp.width() != header.width || bmp.height() != header.height) {
+		std::cerr << "Error: Frame \"" << filename << "\" is " << bmp.width() << "x" << bmp.height()
+			<< " but the animation is " << header.width << "x" << header.height << ".\n";
+		return false;
+	}
+	return true;
 }
 
-void Flic::getSubChunks(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, std::vector<SubChunk> &subChunks) {
-	uint8_t pixelSkip = 0;
-	const uint8_t *subChunkStart = 0;
-	uint32_t subChunkLength = 0;
-	uint32_t offset = 0;
-	while (offset < width * bpp) {
-		const uint8_t *p = data + offset;
-		const uint8_t *oldP = oldData + offset;
-		if (memcmp(p, oldP, bpp) == 0) {
-			// If we are in the middle of reading a sub-chunk when encountering
-			// a non-updated pixel, we append the subchunk to our vector and
-			// start over
-			if (subChunkLength > 0) {
-				SubChunk subChunk;
-				subChunk.length = subChunkLength;
-				subChunk.pixelSkip = pixelSkip;
-				subChunk.start = subChunkStart;
-				subChunks.push_back(subChunk);
-				pixelSkip = 0;
-				subChunkLength = 0;
-			}
-			++pixelSkip;
-		} else {
-			// If we aren't currently reading a sub-chunk, we store the position
-			// of the first pixel in the next sub-chunk
-			if (subChunkLength == 0) {
-				subChunkStart = p;
-			}
-			++subChunkLength;
+void Flic::prepareFrame(const FlicHeader &header, const Palette *palette, const CompileOptions &options, SourceFrame &frame) {
+	Stats::Clock::time_point start = Stats::Clock::now();
+	if (palette) {
+		uint8_t *indices = new uint8_t[header.width * header.height];
+		palette->map(frame.bitmap.pixels(), indices, header.width * header.height);
+		frame.bitmap.create(std::shared_ptr<uint8_t>(indices, std::default_delete<uint8_t[]>()), header.width, header.height, 8);
+		if (options.stats) {
+			start = options.stats->record(Stage::Downsample, start);
 		}
-		offset += bpp;
 	}
-	// If we have a sub-chunk in progress, append it
-	if (subChunkLength > 0) {
-		SubChunk subChunk;
-		subChunk.length = subChunkLength;
-		subChunk.pixelSkip = pixelSkip;
-		subChunk.start = subChunkStart;
-		subChunks.push_back(subChunk);
+	hashFrame(frame.bitmap.pixels(), header.width, header.height, header.depth / 8, frame.hash);
+	if (options.stats) {
+		options.stats->record(Stage::Hash, start);
 	}
 }
 
-void Flic::encodeDeltaRle(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, std::vector<Packet> &packets) {
-	std::vector<SubChunk> subChunks;
-	getSubChunks(data, oldData, width, bpp, subChunks);
-	for (const auto &subChunk : subChunks) {
-		const uint8_t *last = nullptr;
-		bool repeat = false;
-		uint32_t bytesEncoded = 0, count = 0, offset = 0;
-		int lastSkip = subChunk.pixelSkip;
-		while (bytesEncoded < subChunk.length * bpp) {
-			if (offset >= subChunk.length * bpp) {
-				// Reached end of line but haven't encoded all of it yet.
-				if (repeat) {
-					writeDeltaRepeatPacket(subChunk.start + bytesEncoded, count, bpp, lastSkip, packets);
-				} else {
-					writeDeltaCopyPacket(subChunk.start + bytesEncoded, count, bpp, lastSkip, packets);
-				}
-				lastSkip = 0;
-				break;
+void Flic::filterFrame(const FlicHeader &header, const Palette *palette, const CompileOptions &options, NearMatchFilter &filter, bool keyframe, SourceFrame &frame) {
+	Stats::Clock::time_point start = Stats::Clock::now();
+	// The source pixels are kept to measure the error once the frame is
+	// converted
+	Bitmap source = frame.bitmap;
+	uint8_t *pixels = new uint8_t[header.width * header.height * 2];
+	filter.apply(source.pixels(), pixels, keyframe);
+	frame.bitmap.create(std::shared_ptr<uint8_t>(pixels, std::default_delete<uint8_t[]>()), header.width, header.height, 16);
+	if (options.stats) {
+		options.stats->record(Stage::Filter, start);
+	}
+	prepareFrame(header, palette, options, frame);
+	start = Stats::Clock::now();
+	filter.measure(source.pixels(), frame.bitmap.pixels(), palette ? palette->colors().data() : nullptr);
+	if (options.stats) {
+		options.stats->record(Stage::Filter, start);
+	}
+}
+
+uint32_t Flic::encodeFrame(const FlicHeader &header, const SourceFrame *previous, const SourceFrame &current, const CompileOptions &options, const ChunkCache *cache, const Palette *palette, std::vector<uint8_t> &buffer, FrameEncoding &encoding, int64_t *packets) {
+	// A repeated frame can't be stored any smaller than an empty delta. The
+	// hashes find it cheaply, and one compare of the pixels makes sure a
+	// collision doesn't drop a frame that did change.
+	if (previous && !current.hash.lines.empty() && previous->hash == current.hash &&
+		memcmp(previous->bitmap.pixels(), current.bitmap.pixels(), header.width * header.height * (header.depth / 8)) == 0) {
+		encoding = FrameEncoding::Duplicate;
+		if (packets) {
+			*packets = 0;
+		}
+		return createEmptyLc(header, buffer);
+	}
+
+	size_t frameOffset = buffer.size();
+	CacheKey key;
+	if (cache) {
+		key = cacheKey(header, previous, current, options, palette);
+		if (cache->load(key, buffer)) {
+			encoding = FrameEncoding::Cached;
+			if (packets) {
+				*packets = -1;
 			}
-			const uint8_t *p = subChunk.start + offset;
-			if (last && !repeat && memcmp(p, last, bpp) == 0) {
-				repeat = true;
-				if (count > 1) {
-					count -= 1;
-					writeDeltaCopyPacket(subChunk.start + bytesEncoded, count, bpp, lastSkip, packets);
-					lastSkip = 0;
-					bytesEncoded += count * bpp;
-					count = 1;
-				}
-			} else if (last && repeat && memcmp(p, last, bpp) != 0) {
-				repeat = false;
-				writeDeltaRepeatPacket(subChunk.start + bytesEncoded, count, bpp, lastSkip, packets);
-				lastSkip = 0;
-				bytesEncoded += count * bpp;
-				count = 0;
+			return buffer.size() - frameOffset;
+		}
+	}
+	encoding = FrameEncoding::Encoded;
+
+	const Bitmap &bmp = current.bitmap;
+	uint32_t packetCount = 0;
+	uint32_t frameSize = previous ? createLc(header, *previous, current, options, buffer, &packetCount) : createBrun(header, bmp, options, buffer, &packetCount);
+	if (packets) {
+		*packets = packetCount;
+	}
+	// A delta is only worth comparing to a DTA_BRUN frame if it is bigger
+	// than the smallest one could be, which rules out most deltas without
+	// encoding the frame twice
+	if (options.adaptiveChunks && previous && frameSize > minBrunSize(header)) {
+		static thread_local std::vector<uint8_t> brun;
+		brun.clear();
+		uint32_t brunPackets = 0;
+		uint32_t brunSize = createBrun(header, bmp, options, brun, &brunPackets);
+		if (brunSize < frameSize) {
+			buffer.resize(frameOffset);
+			buffer.insert(buffer.end(), brun.begin(), brun.end());
+			frameSize = brunSize;
+			if (packets) {
+				*packets = brunPackets;
 			}
-			last = p;
-			offset += bpp;
-			++count;
 		}
 	}
+	size_t copySize = sizeof(FlicFrameHeader) + sizeof(FlicChunkHeader) + header.width * header.height * (header.depth / 8);
+	if (options.adaptiveChunks && copySize < frameSize) {
+		buffer.resize(frameOffset);
+		frameSize = createCopy(header, bmp, buffer);
+		if (packets) {
+			*packets = 0;
+		}
+	}
+	// Every keyframe of a palettized file sets the whole palette, so that it
+	// can be decoded without the frames before it
+	if (palette && !previous) {
+		frameSize = insertColor(*palette, frameOffset, buffer);
+	}
+	if (cache) {
+		cache->store(key, buffer.data() + frameOffset, frameSize);
+	}
+	return frameSize;
+}
+
+CacheKey Flic::cacheKey(const FlicHeader &header, const SourceFrame *previous, const SourceFrame &current, const CompileOptions &options, const Palette *palette) {
+	// Anything that changes the encoded frame has to be part of the key.
+	// The version has to change whenever the encoder produces different
+	// frames from the same input
+	const uint32_t encoderVersion = 1;
+	uint32_t settings[] = {
+		encoderVersion, header.width, header.height, header.depth,
+		previous != nullptr, options.optimal, options.adaptiveChunks
+	};
+	std::vector<uint64_t> hashes;
+	hashes.reserve(header.height * 2);
+	if (previous) {
+		hashes.insert(hashes.end(), previous->hash.lines.begin(), previous->hash.lines.end());
+	}
+	hashes.insert(hashes.end(), current.hash.lines.begin(), current.hash.lines.end());
+	// The indices of a palettized frame only mean something together with
+	// the palette, which keyframes also carry
+	if (palette) {
+		hashes.push_back(palette->hash());
+	}
+	// The key is made of two hashes with different seeds, but both of them
+	// hash the same 64-bit line hashes, so two frames whose line hashes
+	// collide share a key as well. It is no stronger than the line hashes.
+	CacheKey key;
+	key.high = hashBytes(reinterpret_cast<const uint8_t*>(settings), sizeof(settings), 1);
+	key.high = hashBytes(reinterpret_cast<const uint8_t*>(hashes.data()), hashes.size() * sizeof(uint64_t), key.high);
+	key.low = hashBytes(reinterpret_cast<const uint8_t*>(settings), sizeof(settings), 2);
+	key.low = hashBytes(reinterpret_cast<const uint8_t*>(hashes.data()), hashes.size() * sizeof(uint64_t), key.low);
+	return key;
 }
 
-uint32_t Flic::createLc(const FlicHeader &header, const Bitmap &lastBmp, const Bitmap &bmp, std::ostream &os) {
-	FlicFrameHeader frameHeader = { 0 };
-	frameHeader.magic = 0xf1fa;
-	frameHeader.chunks = 1;
-	// We don't know the size of this frame yet so leave it blank for now
-	int32_t frameOffset = (int32_t)os.tellp();
-	os.write(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader));
-	FlicChunkHeader chunkHeader = { 0 };
-	chunkHeader.type = FlicChunkType::FLI_DTA_LC;
-	// We don't know the size of the chunk either
-	int32_t chunkOffset = (int32_t)os.tellp();
-	os.write(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader));
-	
-	// We don't know the number of lines to update yet, so we will leave a
-	// spot for the line count here
-	int32_t lineOffset = (int32_t)os.tellp();
-	int16_t nil = 0;
-	os.write(reinterpret_cast<char*>(&nil), 2);
-
-	size_t pitch = header.width * (header.depth / 8);
-	int16_t lineSkip = 0;
-	uint16_t lines = 0;
-	for (int y = header.height - 1; y >= 0; --y) {
-		const uint8_t *line = bmp.pixels() + y * pitch;
-		const uint8_t *lastLine = lastBmp.pixels() + y * pitch;
-		if (memcmp(line, lastLine, pitch) == 0) {
-			// Line is exactly the same, skip it
-			++lineSkip;
-			continue;
+void Flic::writeFrame(FlicHeader &header, uint32_t index, const std::vector<uint8_t> &buffer, std::ostream *os, std::vector<uint8_t> &file) {
+	if (index == 0) {
+		setFirstFrameSize(header, buffer.size());
+		if (os) {
+			os->write(reinterpret_cast<char*>(&header), sizeof(header));
 		} else {
-			if (lineSkip > 0) {
-				lineSkip = -lineSkip;
-				os.write(reinterpret_cast<char*>(&lineSkip), 2);
-			}
-			std::vector<Packet> packets;
-			encodeDeltaRle(line, lastLine, header.width, header.depth / 8, packets);
-			uint16_t packetCount = packets.size();
-			os.write(reinterpret_cast<char*>(&packetCount), 2);
-			for (const auto &packet : packets) {
-				os.write(packet.data, packet.size);
-				delete packet.data;
-			}
-			++lines;
-			lineSkip = 0;
+			append(file, header);
 		}
 	}
+	if (os) {
+		os->write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	} else {
+		file.insert(file.end(), buffer.begin(), buffer.end());
+	}
+}
 
-	// Now we need to go back to the fields we didn't know the values of before and fill them in
-	int32_t frameEnd = (int32_t)os.tellp();
-	os.seekp(lineOffset, std::ios_base::beg);
-	os.write(reinterpret_cast<char*>(&lines), 2);
-	os.seekp(chunkOffset, std::ios_base::beg);
-	int32_t chunkSize = frameEnd - chunkOffset;
-	os.write(reinterpret_cast<char*>(&chunkSize), 4);
-	os.seekp(frameOffset, std::ios_base::beg);
-	int32_t frameSize = frameEnd - frameOffset;
-	os.write(reinterpret_cast<char*>(&frameSize), 4);
-	os.seekp(frameEnd, std::ios_base::beg);
+void Flic::setFirstFrameSize(FlicHeader &header, uint32_t frameSize) {
+	// FLH files have some weird offset to the end of the first frame in
+	// the header, which we know once the first frame is encoded
+	uint32_t magic80 = 0x80;
+	uint32_t unknownValue = frameSize + 0x80;
+	memcpy(reinterpret_cast<char*>(&header) + 0x50, &magic80, 4);
+	memcpy(reinterpret_cast<char*>(&header) + 0x54, &unknownValue, 4);
+}
 
-	return frameSize;
+bool Flic::encode(const uint8_t *const *frames, uint32_t count, uint32_t width, uint32_t height, std::vector<uint8_t> &output, const CompileOptions &options) {
+	if (count == 0 || count > 0xffff || width == 0 || width > maxLineWidth || height == 0 || height > 0xffff) {
+		std::cerr << "Error: Can't encode " << count << " frames of " << width << "x" << height << " pixels.\n";
+		return false;
+	}
+	FlicHeader header = { 0 };
+	header.magic = 0xaf43;
+	header.frames = count;
+	header.width = width;
+	header.height = height;
+	header.depth = 16;
+
+	Palette palette;
+	const Palette *framePalette = nullptr;
+	if (options.palettized) {
+		for (uint32_t i = 0; i < count; ++i) {
+			palette.addPixels(frames[i], width * height);
+		}
+		palette.build();
+		header.depth = 8;
+		framePalette = &palette;
+	}
+	NearMatchFilter filter(width, height, options.tolerance);
+
+	// The header is written first and filled in once the frames are encoded
+	size_t fileOffset = output.size();
+	append(output, header);
+	SourceFrame previous;
+	for (uint32_t i = 0; i < count; ++i) {
+		// The bitmaps only borrow the pixels of the caller
+		SourceFrame current;
+		current.bitmap.create(std::shared_ptr<uint8_t>(const_cast<uint8_t*>(frames[i]), [](uint8_t *) {}), width, height, 16);
+		if (options.tolerance > 0) {
+			filterFrame(header, framePalette, options, filter, isKeyframe(i, options), current);
+		} else {
+			prepareFrame(header, framePalette, options, current);
+		}
+		FrameEncoding encoding;
+		uint32_t frameSize = encodeFrame(header, isKeyframe(i, options) ? nullptr : &previous, current, options, nullptr, framePalette, output, encoding);
+		if (i == 0) {
+			setFirstFrameSize(header, frameSize);
+		}
+		previous = current;
+	}
+	header.size = output.size() - fileOffset;
+	patch(output, fileOffset, header);
+	return true;
 }
 
-void Flic::decompile(const std::string &input, const std::string &output) {
-	std::cout << "Decompiling \"" << input << "\" > \"" << output << "\"\n";
+bool Flic::decode(const uint8_t *data, size_t size, const std::function<uint8_t *(const FlicHeader &header, uint32_t index)> &frameBuffer) {
+	FlicReader reader;
+	if (!reader.open(data, size)) {
+		return false;
+	}
+	const FlicHeader &header = reader.header();
+	size_t frameSize = reader.frameSize();
+	for (uint32_t i = 0; i < header.frames; ++i) {
+		if (!reader.decodeFrame(i)) {
+			return false;
+		}
+		uint8_t *pixels = frameBuffer(header, i);
+		if (!pixels) {
+			return false;
+		}
+		memcpy(pixels, reader.pixels(), frameSize);
+	}
+	return true;
+}
 
-	std::ifstream ifs(input, std::ios_base::binary);
+bool Flic::decompile(const std::string &input, const std::string &output, const DecompileOptions &options) {
+	if (!options.quiet) {
+		std::cout << "Decompiling \"" << input << "\" > \"" << output << "\"\n";
+	}
+
+	Stats *stats = options.stats;
+	Stats::Clock::time_point start = Stats::Clock::now();
+	FlicReader reader;
+	if (!reader.open(input)) {
+		return false;
+	}
+	const FlicHeader &header = reader.header();
+	if (stats) {
+		stats->record(Stage::Load, start);
+		stats->setAnimation(header.frames, header.width, header.height, header.depth);
+	}
 
-	FlicHeader header;
-	ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
-	if (header.magic != 0xaf43) {
-		std::cerr << "Error: Flic file is not a valid Rock Raiders Flic file!" << std::endl;
-		return;
+	if (options.frame > reader.frames().size()) {
+		std::cerr << "Error: The Flic file only has " << reader.frames().size() << " frames." << std::endl;
+		return false;
+	}
+	if (options.format != FrameFormat::Bitmap) {
+		if (options.frame > 0) {
+			return streamFrames(reader, options.frame - 1, 1, output, options);
+		}
+		return streamFrames(reader, 0, header.frames, output, options);
 	}
+
+	// A single frame can be decoded straight from the nearest keyframe
+	if (options.frame > 0) {
+		if (!decodeFrame(reader, options.frame - 1, stats)) {
+			return false;
+		}
+		start = Stats::Clock::now();
+		bool saved = saveFrame(header, reader.pixels(), options.frame - 1, output);
+		if (stats) {
+			stats->record(Stage::Save, start);
+		}
+		return saved;
+	}
+
+	// Frames are decoded one after another into the same frame buffer and
+	// saved as soon as they have been decoded, so only a single frame is
+	// ever kept in memory, no matter how long the animation is.
+	// With more than one job, the frames are saved by a pool of writer
+	// threads while the next frames are decoded. Every decoded frame is
+	// copied into one of a fixed number of spare buffers, which the writers
+	// hand back once the frame is saved. When all of them are in use the
+	// decoder waits, which keeps memory use bounded.
+	size_t frameSize = reader.frameSize();
+	uint32_t jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+	BoundedQueue<DecodedFrame> pending(jobs);
+	BoundedQueue<std::vector<uint8_t>> spare(jobs * 2);
+	std::atomic<bool> writeFailed(false);
+	std::vector<std::thread> writers;
+	if (jobs > 1) {
+		for (uint32_t j = 0; j < jobs * 2; ++j) {
+			spare.push(std::vector<uint8_t>(frameSize));
+		}
+		for (uint32_t j = 0; j < jobs; ++j) {
+			writers.emplace_back([&]() {
+				DecodedFrame decodedFrame;
+				while (pending.pop(decodedFrame)) {
+					Stats::Clock::time_point start = Stats::Clock::now();
+					if (!writeFailed && !saveFrame(header, decodedFrame.pixels.data(), decodedFrame.index, output)) {
+						writeFailed = true;
+					}
+					if (stats) {
+						stats->record(Stage::Save, start);
+					}
+					spare.push(std::move(decodedFrame.pixels));
+				}
+			});
+		}
+	}
+
+	bool success = true;
 	for (uint32_t i = 0; i < header.frames; ++i) {
-		FlicFrameHeader frameHeader;
-		ifs.read(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader));
-		FlicFrame frame;
-		for (uint32_t c = 0; c < frameHeader.chunks; ++c) {
-			FlicChunkHeader chunkHeader;
-			ifs.read(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader));
-			frame.pixels = new uint8_t[header.width * header.height * (header.depth / 8)];
-			switch (chunkHeader.type) {
-			case FLI_DTA_BRUN:
-				readBrun(header, frame, ifs);
-				break;
-			case FLI_DTA_LC:
-				readLc(header, frame, ifs);
+		if (!decodeFrame(reader, i, stats)) {
+			success = false;
+			break;
+		}
+		if (writers.empty()) {
+			start = Stats::Clock::now();
+			if (!saveFrame(header, reader.pixels(), i, output)) {
+				success = false;
 				break;
-			default:
-				std::cerr << "Warning: Unknown chunk type: " << chunkHeader.type << std::endl;
-				ifs.seekg(chunkHeader.size - sizeof(chunkHeader), std::ios_base::cur);
+			}
+			if (stats) {
+				stats->record(Stage::Save, start);
+			}
+		} else {
+			if (writeFailed) {
+				success = false;
 				break;
 			}
+			DecodedFrame decodedFrame;
+			decodedFrame.index = i;
+			spare.pop(decodedFrame.pixels);
+			memcpy(decodedFrame.pixels.data(), reader.pixels(), frameSize);
+			pending.push(std::move(decodedFrame));
+		}
+		if (!options.quiet) {
+			progressBar((i + 1), header.frames, 50);
 		}
-		frames_.push_back(frame);
-		progressBar((i + 1), header.frames, 50);
 	}
-	std::cout << "\n";
 
-	fs::path outputPath(output);
+	pending.close();
+	for (auto &writer : writers) {
+		writer.join();
+	}
+	if (writeFailed) {
+		return false;
+	}
+	if (success && !options.quiet) {
+		std::cout << "\n";
+	}
+	return success;
+}
+
+bool Flic::playNull(const std::string &input, const PlayOptions &options) {
+	FlicPlayer player;
+	if (!player.open(input)) {
+		return false;
+	}
+	const FlicHeader &header = player.header();
+	if (header.frames == 0) {
+		std::cerr << "Error: The Flic file doesn't have any frames." << std::endl;
+		return false;
+	}
+	player.setLooping(true);
+	std::vector<uint8_t> target(player.frameSize());
 
-	for (size_t i = 0; i < frames_.size(); ++i) {
-		const auto &frame = frames_[i];
-		std::ostringstream frameName;
-		frameName << "frame" << std::setw(4) << std::setfill('0') << (i + 1) << ".bmp";
-		Bitmap bmp(frame.pixels, header.width, header.height, header.depth);
-		if (!bmp.save((outputPath / frameName.str()).string())) {
-			std::cerr << "Error: Writing bitmap " << (outputPath / frameName.str()) << " failed.\n";
-			return;
+	uint64_t frames = static_cast<uint64_t>(header.frames) * std::max(1u, options.loops);
+	FlicPlayer::Clock::duration worst(0);
+	uint32_t worstFrame = 0;
+	FlicPlayer::Clock::time_point start = FlicPlayer::Clock::now();
+	for (uint64_t i = 0; i < frames; ++i) {
+		uint32_t index = player.position() % header.frames;
+		FlicPlayer::Clock::time_point frameStart = FlicPlayer::Clock::now();
+		if (!player.decodeNext(target.data())) {
+			return false;
+		}
+		FlicPlayer::Clock::duration frameTime = FlicPlayer::Clock::now() - frameStart;
+		if (frameTime > worst) {
+			worst = frameTime;
+			worstFrame = index;
 		}
 	}
+	double seconds = std::chrono::duration<double>(FlicPlayer::Clock::now() - start).count();
+
+	uint64_t bytes = 0;
+	uint32_t largest = 0;
+	for (const FlicFrameInfo &info : player.frames()) {
+		bytes += info.size;
+		largest = std::max(largest, info.size);
+	}
+	double budget = std::chrono::duration<double, std::milli>(player.frameDuration()).count();
+	double worstMs = std::chrono::duration<double, std::milli>(worst).count();
+	bool keepsUp = worst <= player.frameDuration();
+	std::streamsize precision = std::cout.precision();
+	std::cout << "Played \"" << input << "\": " << frames << " frames of " << header.width << "x" << header.height
+		<< " in " << std::fixed << std::setprecision(3) << seconds << "s\n";
+	std::cout << "  Frames per second: " << std::setprecision(1) << (seconds > 0 ? frames / seconds : 0.0)
+		<< " (needs " << 1000.0 / budget << ")\n";
+	std::cout << "  Slowest frame:     " << std::setprecision(3) << worstMs << " ms, frame " << (worstFrame + 1)
+		<< " (budget " << budget << " ms)\n";
+	std::cout << "  Bytes per frame:   " << bytes / header.frames << " on average, " << largest << " at most\n";
+	std::cout << "  Result:            " << (keepsUp ? "keeps up in real time" : "too slow for real time") << "\n";
+	std::cout.unsetf(std::ios_base::floatfield);
+	std::cout.precision(precision);
+	return keepsUp;
 }
 
-void Flic::readBrun(const FlicHeader &header, FlicFrame &frame, std::istream &is) {
-	int bytespp = header.depth / 8;
-	for (int y = 0; y < header.height; ++y) {
-		uint8_t packets;
-		is.read(reinterpret_cast<char*>(&packets), 1);
-		int x = 0;
-		while (x < header.width) {
-			int offset = ((header.height - y - 1) * header.width + x) * bytespp;
-			char count;
-			is.read(&count, 1);
-			if (count >= 0) {
-				char *tmp = new char[bytespp];
-				is.read(tmp, bytespp);
-				for (int j = 0; j < count; ++j) {
-					memcpy(frame.pixels + offset + j * bytespp, tmp, bytespp);
-				}
-				x += count;
-				delete tmp;
-			} else {
-				for (int j = 0; j < (-count); ++j) {
-					char *tmp = new char[bytespp];
-					is.read(tmp, bytespp);
-					memcpy(frame.pixels + offset + j * bytespp, tmp, bytespp);
-					delete tmp;
-				}
-				x += -count;
-			}
-		}
+bool Flic::decodeFrame(FlicReader &reader, uint32_t index, Stats *stats) {
+	if (!stats) {
+		return reader.decodeFrame(index);
+	}
+	uint64_t allocations = threadAllocations();
+	Stats::Clock::time_point start = Stats::Clock::now();
+	if (!reader.decodeFrame(index)) {
+		return false;
 	}
+	stats->record(Stage::Decode, start);
+	FrameStats frame;
+	frame.index = index;
+	frame.chunkType = 0;
+	frame.encoding = "decoded";
+	frame.bytes = reader.frames()[index].size;
+	frame.packets = -1;
+	frame.allocations = threadAllocations() - allocations;
+	frame.seconds = std::chrono::duration<double>(Stats::Clock::now() - start).count();
+	stats->addFrame(frame);
+	return true;
 }
 
-void Flic::readLc(const FlicHeader &header, FlicFrame &frame, std::istream &is) {
-	int bytespp = header.depth / 8;
-	memcpy(frame.pixels, frames_.back().pixels, header.width * header.height * bytespp);
-	uint16_t lines;
-	is.read((char*)&lines, 2);
-	int j = 0, y = 0;
-	while (j < lines) {
-		int16_t lineSkip;
-		is.read(reinterpret_cast<char*>(&lineSkip), 2);
-		if (lineSkip < 0) {
-			y += -lineSkip;
-			continue;
-		} else {
-			int packets = lineSkip;
-			int x = 0;
-			for (int k = 0; k < packets; ++k) {
-				uint8_t pixelSkip;
-				is.read((char*)&pixelSkip, 1);
-				x += pixelSkip;
-				int offset = ((header.height - y - 1) * header.width + x) * bytespp;
-				char count;
-				is.read(&count, 1);
-				if (count < 0) {
-					char *tmp = new char[bytespp];
-					is.read(tmp, bytespp);
-					for (int j = 0; j < -count; ++j) {
-						memcpy(frame.pixels + offset + j * bytespp, tmp, bytespp);
-					}
-					x += -count;
-					delete tmp;
-				} else {
-					for (int j = 0; j < count; ++j) {
-						char *tmp = new char[bytespp];
-						is.read(tmp, bytespp);
-						memcpy(frame.pixels + offset + j * bytespp, tmp, bytespp);
-						delete tmp;
-					}
-					x += count;
+bool Flic::streamFrames(FlicReader &reader, uint32_t first, uint32_t count, const std::string &output, const DecompileOptions &options) {
+	const FlicHeader &header = reader.header();
+	Stats *stats = options.stats;
+	bool toStdout = output == "-";
+	std::ofstream ofs;
+	if (toStdout) {
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	} else {
+		ofs.open(output, std::ios_base::binary);
+		if (!ofs.is_open()) {
+			std::cerr << "Error: Unable to open output file \"" << output << "\".\n";
+			return false;
+		}
+	}
+	std::ostream &os = toStdout ? std::cout : static_cast<std::ostream&>(ofs);
+
+	if (options.streamHeader) {
+		FrameStreamHeader streamHeader = { { 'F', 'L', 'R', 'S' }, 1, static_cast<uint16_t>(options.format),
+			header.width, header.height, count, header.speed };
+		os.write(reinterpret_cast<const char*>(&streamHeader), sizeof(streamHeader));
+	}
+
+	// The frames all go to the same stream, so they are written in order as
+	// soon as they are decoded. Every frame is turned upside down into the
+	// same buffer, since the decoded frames start with their bottom row
+	size_t bpp = options.format == FrameFormat::Rgb24 ? 3 : 2;
+	size_t pitch = header.width * bpp;
+	std::vector<uint8_t> buffer(pitch * header.height);
+	bool success = true;
+	for (uint32_t i = 0; i < count && success; ++i) {
+		if (!decodeFrame(reader, first + i, stats)) {
+			success = false;
+			break;
+		}
+		Stats::Clock::time_point start = Stats::Clock::now();
+		for (uint32_t y = 0; y < header.height; ++y) {
+			const uint8_t *src = reader.pixels() + (header.height - y - 1) * header.width * 2;
+			uint8_t *dest = buffer.data() + y * pitch;
+			if (options.format == FrameFormat::Rgb555) {
+				memcpy(dest, src, pitch);
+				continue;
+			}
+			for (uint32_t x = 0; x < header.width; ++x, src += 2, dest += 3) {
+				uint16_t pixel = static_cast<uint16_t>(src[0] | (src[1] << 8));
+				for (int c = 0; c < 3; ++c) {
+					uint8_t value = (pixel >> ((2 - c) * 5)) & 0x1f;
+					dest[c] = static_cast<uint8_t>((value << 3) | (value >> 2));
 				}
 			}
-			++y;
 		}
-		++j;
+		os.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		if (!os) {
+			std::cerr << "\nError: Writing frame " << (first + i + 1) << " to \"" << output << "\" failed.\n";
+			success = false;
+		}
+		if (stats) {
+			stats->record(Stage::Save, start);
+		}
+		if (!options.quiet) {
+			progressBar(i + 1, count, 50);
+		}
+	}
+	os.flush();
+	if (!options.quiet) {
+		std::cout << "\n";
+	}
+	if (!success && !toStdout && fs::is_regular_file(output)) {
+		ofs.close();
+		fs::remove(output);
+	}
+	return success && !os.fail();
+}
+
+bool Flic::saveFrame(const FlicHeader &header, const uint8_t *pixels, uint32_t index, const std::string &output) {
+	std::ostringstream frameName;
+	frameName << "frame" << std::setw(4) << std::setfill('0') << (index + 1) << ".bmp";
+	fs::path path = fs::path(output) / frameName.str();
+	// The bitmap only borrows the pixels for reading, they are still owned
+	// by the caller
+	Bitmap bmp(std::shared_ptr<uint8_t>(const_cast<uint8_t*>(pixels), [](uint8_t *) {}), header.width, header.height, 16);
+	if (!bmp.save(path.string())) {
+		std::cerr << "\nError: Writing bitmap " << path << " failed.\n";
+		return false;
 	}
+	return true;
 }
 
 inline void Flic::progressBar(uint32_t x, uint32_t n, uint32_t w) {
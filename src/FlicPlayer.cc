@@ -0,0 +1,102 @@
+#include <FlicTool/FlicPlayer.h>
+
+#include <cstring>
+#include <thread>
+
+namespace {
+	// Rock Raiders plays its animations at 25 frames per second
+	const std::chrono::milliseconds defaultFrameDuration(40);
+}
+
+FlicPlayer::FlicPlayer() : next_(0), looping_(false), started_(false), lateFrames_(0) {
+}
+
+bool FlicPlayer::open(const std::string &path) {
+	rewind();
+	return reader_.open(path);
+}
+
+bool FlicPlayer::open(const uint8_t *data, size_t size) {
+	rewind();
+	return reader_.open(data, size);
+}
+
+const FlicHeader &FlicPlayer::header() const {
+	return reader_.header();
+}
+
+const std::vector<FlicFrameInfo> &FlicPlayer::frames() const {
+	return reader_.frames();
+}
+
+size_t FlicPlayer::frameSize() const {
+	return reader_.frameSize();
+}
+
+void FlicPlayer::setLooping(bool looping) {
+	looping_ = looping;
+}
+
+FlicPlayer::Clock::duration FlicPlayer::frameDuration() const {
+	uint16_t speed = reader_.header().speed;
+	if (speed == 0) {
+		return defaultFrameDuration;
+	}
+	return std::chrono::milliseconds(speed);
+}
+
+uint32_t FlicPlayer::position() const {
+	return next_;
+}
+
+void FlicPlayer::rewind() {
+	next_ = 0;
+	started_ = false;
+	lateFrames_ = 0;
+}
+
+bool FlicPlayer::decodeNext(uint8_t *target) {
+	if (next_ >= reader_.frames().size()) {
+		if (!looping_ || reader_.frames().empty()) {
+			return false;
+		}
+		next_ = 0;
+	}
+	// The reader only decodes the one frame when it is the frame after the
+	// last one, and starts over from the first keyframe when looping
+	if (!reader_.decodeFrame(next_)) {
+		return false;
+	}
+	memcpy(target, reader_.pixels(), frameSize());
+	++next_;
+	return true;
+}
+
+bool FlicPlayer::playNext(uint8_t *target) {
+	if (!decodeNext(target)) {
+		return false;
+	}
+	Clock::time_point now = Clock::now();
+	if (!started_) {
+		// The first frame is shown as soon as it is decoded, and sets the
+		// schedule of the frames after it
+		due_ = now;
+		started_ = true;
+	} else if (now > due_) {
+		// Frames after a late one keep their places in the schedule, unless
+		// the player has fallen behind by more than a frame, in which case
+		// the schedule starts over from now rather than rushing to catch up
+		++lateFrames_;
+		if (now - due_ > frameDuration()) {
+			due_ = now;
+		}
+	} else {
+		std::this_thread::sleep_until(due_);
+	}
+	due_ += frameDuration();
+	return true;
+}
+
+uint32_t FlicPlayer::lateFrames() const {
+	return lateFrames_;
+}
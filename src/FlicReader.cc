@@ -0,0 +1,257 @@
+#include <FlicTool/FlicReader.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#include "ChunkDecoder.h"
+
+FlicReader::FlicReader() : data_(nullptr), size_(0), current_(-1) {
+}
+
+bool FlicReader::open(const std::string &path) {
+	// The whole file is mapped into memory and parsed in place, so that
+	// pixel data can be copied straight from the file into the frames
+	if (!file_.open(path)) {
+		std::cerr << "Error: Unable to open Flic file \"" << path << "\"." << std::endl;
+		return false;
+	}
+	return parse(file_.data(), file_.size());
+}
+
+bool FlicReader::open(const uint8_t *data, size_t size) {
+	file_.close();
+	return parse(data, size);
+}
+
+bool FlicReader::parse(const uint8_t *data, size_t size) {
+	frames_.clear();
+	current_ = -1;
+	data_ = data;
+	size_ = size;
+	ByteCursor cursor(data_, size_);
+
+	if (!cursor.read(header_) || header_.magic != 0xaf43) {
+		std::cerr << "Error: Flic file is not a valid Rock Raiders Flic file!" << std::endl;
+		return false;
+	}
+	if (header_.depth != 8 && header_.depth != 16) {
+		std::cerr << "Error: Flic file has an unsupported depth of " << header_.depth << " bits." << std::endl;
+		return false;
+	}
+	if (!buildIndex(cursor)) {
+		return false;
+	}
+
+	// Every chunk updates the same frame buffer in place
+	frame_.pixels.assign(header_.width * header_.height * (header_.depth / 8), 0);
+	if (header_.depth == 8) {
+		palette_.assign(256, 0);
+		expanded_.assign(frameSize(), 0);
+	} else {
+		palette_.clear();
+		expanded_.clear();
+	}
+	return true;
+}
+
+size_t FlicReader::frameSize() const {
+	return header_.width * header_.height * sizeof(uint16_t);
+}
+
+const FlicHeader &FlicReader::header() const {
+	return header_;
+}
+
+const std::vector<FlicFrameInfo> &FlicReader::frames() const {
+	return frames_;
+}
+
+bool FlicReader::decodeFrame(uint32_t index) {
+	if (index >= frames_.size()) {
+		return false;
+	}
+	if (current_ == index) {
+		return true;
+	}
+
+	// Start at the nearest keyframe, unless the frame we already have is
+	// between it and the requested frame
+	int64_t keyframe = index;
+	while (keyframe >= 0 && !frames_[keyframe].keyframe) {
+		--keyframe;
+	}
+	int64_t start = keyframe;
+	if (current_ >= 0 && current_ < index && current_ >= keyframe) {
+		start = current_ + 1;
+	}
+	if (start < 0) {
+		std::cerr << "Error: Frame " << (index + 1) << " of the Flic file doesn't follow a keyframe." << std::endl;
+		return false;
+	}
+
+	for (int64_t i = start; i <= index; ++i) {
+		if (!applyFrame(i)) {
+			std::cerr << "Error: Frame " << (i + 1) << " of the Flic file is corrupt." << std::endl;
+			current_ = -1;
+			return false;
+		}
+		current_ = i;
+	}
+
+	// Callers always get 16-bit pixels, so the colors of an 8-bit frame are
+	// looked up once it is decoded
+	if (header_.depth == 8) {
+		uint16_t *dest = reinterpret_cast<uint16_t*>(expanded_.data());
+		for (size_t i = 0; i < frame_.pixels.size(); ++i) {
+			dest[i] = palette_[frame_.pixels[i]];
+		}
+	}
+	return true;
+}
+
+const uint8_t *FlicReader::pixels() const {
+	return header_.depth == 8 ? expanded_.data() : frame_.pixels.data();
+}
+
+bool FlicReader::buildIndex(ByteCursor &cursor) {
+	frames_.reserve(header_.frames);
+	// Unknown chunks are skipped whenever their frame is decoded, but they
+	// are only reported once, here
+	std::set<uint16_t> unknown;
+	for (uint32_t i = 0; i < header_.frames; ++i) {
+		FlicFrameInfo info;
+		info.offset = cursor.position();
+		info.keyframe = false;
+		FlicFrameHeader frameHeader;
+		if (!cursor.read(frameHeader) || frameHeader.size < sizeof(frameHeader)) {
+			std::cerr << "Error: Frame " << (i + 1) << " of the Flic file is corrupt." << std::endl;
+			return false;
+		}
+		info.size = frameHeader.size;
+		// Only the chunk headers are looked at here, a frame is a keyframe
+		// if one of its chunks replaces the whole frame. An 8-bit frame also
+		// has to set the palette
+		ByteCursor frameCursor = cursor.sub(frameHeader.size - sizeof(frameHeader));
+		bool replaced = false, colored = header_.depth != 8;
+		for (uint32_t c = 0; c < frameHeader.chunks; ++c) {
+			FlicChunkHeader chunkHeader;
+			if (!frameCursor.read(chunkHeader) || chunkHeader.size < sizeof(chunkHeader)) {
+				break;
+			}
+			frameCursor.sub(chunkHeader.size - sizeof(chunkHeader));
+			bool eightBit = chunkHeader.type == FLI_BRUN || chunkHeader.type == FLI_COPY || chunkHeader.type == FLI_LC || chunkHeader.type == FLI_COLOR;
+			if (eightBit && header_.depth != 8) {
+				// The 8-bit chunks mean nothing to a 16-bit file
+				unknown.insert(chunkHeader.type);
+				continue;
+			}
+			switch (chunkHeader.type) {
+			case FLI_DTA_BRUN:
+			case FLI_DTA_COPY:
+			case FLI_BRUN:
+			case FLI_COPY:
+				replaced = true;
+				break;
+			case FLI_COLOR:
+				colored = true;
+				break;
+			case FLI_DTA_LC:
+			case FLI_LC:
+				break;
+			default:
+				unknown.insert(chunkHeader.type);
+				break;
+			}
+		}
+		info.keyframe = replaced && colored;
+		if (frameCursor.failed()) {
+			std::cerr << "Error: Frame " << (i + 1) << " of the Flic file is corrupt." << std::endl;
+			return false;
+		}
+		frames_.push_back(info);
+	}
+	for (uint16_t type : unknown) {
+		std::cerr << "Warning: Unknown chunk type: " << type << std::endl;
+	}
+	return true;
+}
+
+bool FlicReader::applyFrame(uint32_t index) {
+	const FlicFrameInfo &info = frames_[index];
+	ByteCursor frameCursor(data_ + info.offset, info.size);
+	FlicFrameHeader frameHeader;
+	frameCursor.read(frameHeader);
+	// Chunks are read through cursors of their own, which keeps a damaged
+	// chunk from reading into the next one
+	for (uint32_t c = 0; c < frameHeader.chunks; ++c) {
+		FlicChunkHeader chunkHeader;
+		frameCursor.read(chunkHeader);
+		ByteCursor chunkCursor = frameCursor.sub(chunkHeader.size - sizeof(chunkHeader));
+		bool valid = true;
+		switch (chunkHeader.type) {
+		case FLI_DTA_BRUN:
+			valid = readBrun(chunkCursor, header_, frame_.pixels.data());
+			break;
+		case FLI_DTA_COPY:
+			valid = readCopy(chunkCursor, header_, frame_.pixels.data());
+			break;
+		case FLI_DTA_LC:
+			// A delta needs the previous frame to apply it to
+			valid = current_ == static_cast<int64_t>(index) - 1 && readLc(chunkCursor, header_, frame_.pixels.data());
+			break;
+		case FLI_BRUN:
+		case FLI_COPY:
+		case FLI_LC:
+		case FLI_COLOR:
+			// The 8-bit chunks mean nothing to a 16-bit file, which skips
+			// them like any other chunk it doesn't know
+			if (header_.depth != 8) {
+				break;
+			}
+			if (chunkHeader.type == FLI_BRUN) {
+				valid = readBrun(chunkCursor, header_, frame_.pixels.data());
+			} else if (chunkHeader.type == FLI_COPY) {
+				valid = readCopy(chunkCursor, header_, frame_.pixels.data());
+			} else if (chunkHeader.type == FLI_LC) {
+				valid = current_ == static_cast<int64_t>(index) - 1 && readFliLc(chunkCursor, header_, frame_.pixels.data());
+			} else {
+				valid = readColor(chunkCursor);
+			}
+			break;
+		default:
+			// Reported once when the file was indexed
+			break;
+		}
+		if (!valid) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FlicReader::readColor(ByteCursor &cursor) {
+	uint16_t packets;
+	if (!cursor.read(packets)) {
+		return false;
+	}
+	uint32_t index = 0;
+	for (uint32_t k = 0; k < packets; ++k) {
+		uint8_t skip, count;
+		if (!cursor.read(skip) || !cursor.read(count)) {
+			return false;
+		}
+		index += skip;
+		uint32_t n = count == 0 ? 256 : count;
+		const uint8_t *src = cursor.take(n * 3);
+		if (!src || index + n > palette_.size()) {
+			return false;
+		}
+		// The colors have 6 bits per channel, of which the frames only keep 5
+		for (uint32_t i = 0; i < n; ++i, src += 3) {
+			palette_[index++] = static_cast<uint16_t>(((src[0] >> 1) << 10) | ((src[1] >> 1) << 5) | (src[2] >> 1));
+		}
+	}
+	return true;
+}
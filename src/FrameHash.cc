@@ -0,0 +1,58 @@
+#include <FlicTool/FrameHash.h>
+
+#include <cstring>
+
+namespace {
+	const uint64_t prime1 = 0x9e3779b97f4a7c15ull;
+	const uint64_t prime2 = 0xbf58476d1ce4e5b9ull;
+	const uint64_t prime3 = 0x94d049bb133111ebull;
+
+	inline uint64_t rotate(uint64_t n, int bits) {
+		return (n << bits) | (n >> (64 - bits));
+	}
+
+	inline uint64_t mix(uint64_t h, uint64_t word) {
+		return rotate(h ^ (word * prime1), 31) * prime2;
+	}
+
+	// Spreads every bit of the state over the whole hash
+	inline uint64_t finish(uint64_t h) {
+		h = (h ^ (h >> 30)) * prime2;
+		h = (h ^ (h >> 27)) * prime3;
+		return h ^ (h >> 31);
+	}
+}
+
+uint64_t hashBytes(const uint8_t *data, size_t size, uint64_t seed) {
+	// Four independent lanes keep the multiplications from waiting on each other
+	uint64_t lanes[4] = { seed, seed + prime1, seed + prime2, seed + prime3 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (int lane = 0; lane < 4; ++lane) {
+			uint64_t word;
+			memcpy(&word, data + i + lane * 8, 8);
+			lanes[lane] = mix(lanes[lane], word);
+		}
+	}
+	uint64_t h = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = mix(h, word);
+	}
+	if (i < size) {
+		uint64_t word = 0;
+		memcpy(&word, data + i, size - i);
+		h = mix(h, word);
+	}
+	return finish(h ^ size);
+}
+
+void hashFrame(const uint8_t *pixels, uint32_t width, uint32_t height, uint8_t bpp, FrameHash &hash) {
+	size_t pitch = width * bpp;
+	hash.lines.resize(height);
+	for (uint32_t y = 0; y < height; ++y) {
+		hash.lines[y] = hashBytes(pixels + y * pitch, pitch, y);
+	}
+	hash.frame = hashBytes(reinterpret_cast<const uint8_t*>(hash.lines.data()), height * sizeof(uint64_t), pitch);
+}
\ No newline at end of file
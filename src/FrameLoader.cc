@@ -0,0 +1,63 @@
+#include <FlicTool/FrameLoader.h>
+
+#include <algorithm>
+
+FrameLoader::FrameLoader(uint32_t begin, uint32_t end, uint32_t threads, uint32_t prefetch, const LoadFunction &load)
+	: next_(begin), end_(end), claimed_(begin), prefetch_(std::max(1u, prefetch)), stopped_(false), load_(load) {
+	threads = std::min(std::max(1u, threads), std::max(1u, end > begin ? end - begin : 0));
+	for (uint32_t t = 0; t < threads; ++t) {
+		threads_.emplace_back([this]() { run(); });
+	}
+}
+
+FrameLoader::~FrameLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopped_ = true;
+		cv_.notify_all();
+	}
+	for (auto &thread : threads_) {
+		thread.join();
+	}
+}
+
+bool FrameLoader::next(SourceFrame &frame) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (next_ >= end_) {
+		return false;
+	}
+	cv_.wait(lock, [&]() { return loaded_.count(next_) > 0; });
+	auto iter = loaded_.find(next_);
+	bool success = iter->second.success;
+	frame = std::move(iter->second.frame);
+	loaded_.erase(iter);
+	// Nothing after a frame that couldn't be loaded is handed out, so the
+	// loaders can stop as well
+	if (success) {
+		++next_;
+	} else {
+		next_ = end_;
+		stopped_ = true;
+	}
+	cv_.notify_all();
+	return success;
+}
+
+void FrameLoader::run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		// Frames are claimed in order, so the frame the consumer waits for is
+		// always the first one to be loaded
+		cv_.wait(lock, [&]() { return stopped_ || claimed_ >= end_ || claimed_ < next_ + prefetch_; });
+		if (stopped_ || claimed_ >= end_) {
+			return;
+		}
+		uint32_t index = claimed_++;
+		lock.unlock();
+		LoadedFrame loaded;
+		loaded.success = load_(index, loaded.frame);
+		lock.lock();
+		loaded_[index] = std::move(loaded);
+		cv_.notify_all();
+	}
+}
@@ -0,0 +1,172 @@
+#include <FlicTool/LineDiff.h>
+
+#include <cstring>
+
+// The x86 kernels are compiled with function-specific target attributes and
+// picked at runtime, so the rest of the program doesn't need any special
+// compiler flags. Older versions of GCC don't expose the intrinsics unless
+// the instruction set is enabled for the whole translation unit.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FLICTOOL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+	/**
+	 * A kernel compares as many 16-bit pixels as it can in whole vectors.
+	 * It sets the bits of \code changed \endcode for pixels that differ from
+	 * the previous frame and the bits of \code equalNext \endcode for pixels
+	 * that are equal to the pixel after them, and returns the number of
+	 * pixels it has handled. The rest of the line is left to the caller.
+	 */
+	typedef uint32_t (*DiffKernel)(const uint16_t *data, const uint16_t *oldData, uint32_t width, uint64_t *changed, uint64_t *equalNext);
+
+	uint32_t diffScalar(const uint16_t *, const uint16_t *, uint32_t, uint64_t *, uint64_t *) {
+		return 0;
+	}
+
+#ifdef FLICTOOL_X86_KERNELS
+	__attribute__((target("sse2")))
+	uint32_t diffSse2(const uint16_t *data, const uint16_t *oldData, uint32_t width, uint64_t *changed, uint64_t *equalNext) {
+		uint32_t x = 0;
+		// Every iteration also looks at the pixel after the block
+		for (; x + 17 <= width; x += 16) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + x));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + x + 8));
+			__m128i nextA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + x + 1));
+			__m128i nextB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + x + 9));
+			// Packing the 16-bit comparison results to bytes gives one bit per pixel
+			uint32_t bits = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, nextA), _mm_cmpeq_epi16(b, nextB)));
+			equalNext[x / 64] |= static_cast<uint64_t>(bits) << (x % 64);
+			if (oldData) {
+				__m128i oldA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(oldData + x));
+				__m128i oldB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(oldData + x + 8));
+				bits = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, oldA), _mm_cmpeq_epi16(b, oldB)));
+				changed[x / 64] |= static_cast<uint64_t>(~bits & 0xffff) << (x % 64);
+			}
+		}
+		return x;
+	}
+
+	__attribute__((target("avx2")))
+	uint32_t diffAvx2(const uint16_t *data, const uint16_t *oldData, uint32_t width, uint64_t *changed, uint64_t *equalNext) {
+		uint32_t x = 0;
+		for (; x + 33 <= width; x += 32) {
+			__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + x));
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + x + 16));
+			__m256i nextA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + x + 1));
+			__m256i nextB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + x + 17));
+			// Packing works on each 128-bit lane separately, so the 64-bit
+			// quarters have to be put back in order before taking the mask
+			__m256i packed = _mm256_packs_epi16(_mm256_cmpeq_epi16(a, nextA), _mm256_cmpeq_epi16(b, nextB));
+			uint32_t bits = _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0xd8));
+			equalNext[x / 64] |= static_cast<uint64_t>(bits) << (x % 64);
+			if (oldData) {
+				__m256i oldA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(oldData + x));
+				__m256i oldB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(oldData + x + 16));
+				packed = _mm256_packs_epi16(_mm256_cmpeq_epi16(a, oldA), _mm256_cmpeq_epi16(b, oldB));
+				bits = _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0xd8));
+				changed[x / 64] |= static_cast<uint64_t>(~bits) << (x % 64);
+			}
+		}
+		return x;
+	}
+#endif
+
+	struct KernelChoice {
+		DiffKernel kernel;
+		const char *name;
+	};
+
+	KernelChoice selectKernel() {
+		KernelChoice choice = { diffScalar, "scalar" };
+#ifdef FLICTOOL_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			choice.kernel = diffAvx2;
+			choice.name = "avx2";
+		} else if (__builtin_cpu_supports("sse2")) {
+			choice.kernel = diffSse2;
+			choice.name = "sse2";
+		}
+#endif
+		return choice;
+	}
+
+	const KernelChoice &kernel() {
+		static const KernelChoice choice = selectKernel();
+		return choice;
+	}
+
+	inline uint32_t countTrailingZeros(uint64_t n) {
+#if defined(__GNUC__)
+		return __builtin_ctzll(n);
+#else
+		uint32_t count = 0;
+		for (; (n & 1) == 0; n >>= 1) ++count;
+		return count;
+#endif
+	}
+}
+
+uint32_t findMaskBit(const uint64_t *mask, uint32_t from, uint32_t width, bool value) {
+	if (from >= width) {
+		return width;
+	}
+	size_t words = maskWords(width);
+	size_t w = from / 64;
+	uint64_t bits = (value ? mask[w] : ~mask[w]) & (~uint64_t(0) << (from % 64));
+	while (bits == 0) {
+		if (++w >= words) {
+			return width;
+		}
+		bits = value ? mask[w] : ~mask[w];
+	}
+	uint32_t x = w * 64 + countTrailingZeros(bits);
+	return x < width ? x : width;
+}
+
+bool diffLine(const uint8_t *data, const uint8_t *oldData, uint32_t width, uint8_t bpp, uint64_t *changed, uint64_t *same) {
+	size_t words = maskWords(width);
+	if (oldData) {
+		memset(changed, 0, words * sizeof(uint64_t));
+	}
+	memset(same, 0, words * sizeof(uint64_t));
+
+	// The kernels find the pixels that are equal to the pixel after them,
+	// since that never needs to look before the start of the line
+	uint32_t x = 0;
+	if (bpp == 2) {
+		x = kernel().kernel(reinterpret_cast<const uint16_t*>(data), reinterpret_cast<const uint16_t*>(oldData), width, changed, same);
+	}
+	for (; x < width; ++x) {
+		const uint8_t *p = data + x * bpp;
+		if (oldData && memcmp(p, oldData + x * bpp, bpp) != 0) {
+			changed[x / 64] |= uint64_t(1) << (x % 64);
+		}
+		if (x + 1 < width && memcmp(p, p + bpp, bpp) == 0) {
+			same[x / 64] |= uint64_t(1) << (x % 64);
+		}
+	}
+
+	// Shifting the mask by one pixel turns "equal to the next pixel" into
+	// "equal to the previous pixel"
+	uint64_t carry = 0;
+	for (size_t w = 0; w < words; ++w) {
+		uint64_t next = same[w] >> 63;
+		same[w] = (same[w] << 1) | carry;
+		carry = next;
+	}
+
+	if (oldData) {
+		for (size_t w = 0; w < words; ++w) {
+			if (changed[w] != 0) return true;
+		}
+	}
+	return false;
+}
+
+const char *diffKernelName() {
+	return kernel().name;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include <FlicTool/MappedFile.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace fs = boost::filesystem;
+namespace ip = boost::interprocess;
+
+MappedFile::MappedFile() {
+}
+
+MappedFile::~MappedFile() {
+}
+
+bool MappedFile::open(const std::string &path) {
+	close();
+
+	boost::system::error_code ec;
+	uintmax_t fileSize = fs::file_size(path, ec);
+	if (ec) {
+		return false;
+	}
+	// Empty files can't be mapped, but they are still valid files
+	if (fileSize == 0) {
+		return true;
+	}
+
+	try {
+		mapping_.reset(new ip::file_mapping(path.c_str(), ip::read_only));
+		region_.reset(new ip::mapped_region(*mapping_, ip::read_only));
+	} catch (const ip::interprocess_exception &) {
+		region_.reset();
+		mapping_.reset();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	region_.reset();
+	mapping_.reset();
+}
+
+const uint8_t *MappedFile::data() const {
+	return region_ ? static_cast<const uint8_t*>(region_->get_address()) : nullptr;
+}
+
+size_t MappedFile::size() const {
+	return region_ ? region_->get_size() : 0;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include <FlicTool/NearMatch.h>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+	inline uint16_t loadPixel(const uint8_t *pixels, size_t i) {
+		// Frames mapped from a bitmap file aren't always aligned
+		uint16_t pixel;
+		memcpy(&pixel, pixels + i * 2, sizeof(pixel));
+		return pixel;
+	}
+
+	inline uint32_t channelDistance(uint16_t a, uint16_t b, int shift) {
+		int d = static_cast<int>((a >> shift) & 0x1f) - static_cast<int>((b >> shift) & 0x1f);
+		return static_cast<uint32_t>(d < 0 ? -d : d);
+	}
+}
+
+NearMatchFilter::NearMatchFilter(uint32_t width, uint32_t height, uint32_t tolerance)
+	: pixels_(static_cast<size_t>(width) * height), tolerance_(tolerance), last_(pixels_, 0), squaredError_(0), samples_(0) {
+}
+
+size_t NearMatchFilter::apply(const uint8_t *source, uint8_t *target, bool keyframe) {
+	if (keyframe || tolerance_ == 0) {
+		memcpy(last_.data(), source, pixels_ * 2);
+		memcpy(target, source, pixels_ * 2);
+		return 0;
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < pixels_; ++i) {
+		uint16_t pixel = loadPixel(source, i);
+		uint16_t last = last_[i];
+		if (channelDistance(pixel, last, 0) <= tolerance_ && channelDistance(pixel, last, 5) <= tolerance_ &&
+			channelDistance(pixel, last, 10) <= tolerance_) {
+			// The player still shows the old pixel, so it stays what the
+			// next frame is compared to
+			pixel = last;
+			++kept;
+		}
+		last_[i] = pixel;
+	}
+	memcpy(target, last_.data(), pixels_ * 2);
+	return kept;
+}
+
+void NearMatchFilter::measure(const uint8_t *source, const uint8_t *stored, const uint16_t *palette) {
+	uint64_t error = 0;
+	for (size_t i = 0; i < pixels_; ++i) {
+		uint16_t a = loadPixel(source, i);
+		uint16_t b = palette ? palette[stored[i]] : loadPixel(stored, i);
+		for (int shift = 0; shift < 15; shift += 5) {
+			uint32_t d = channelDistance(a, b, shift);
+			error += d * d;
+		}
+	}
+	squaredError_ += error;
+	samples_ += pixels_ * 3;
+}
+
+double NearMatchFilter::psnr() const {
+	if (squaredError_ == 0) {
+		return std::numeric_limits<double>::infinity();
+	}
+	double mse = static_cast<double>(squaredError_) / samples_;
+	return 10.0 * std::log10(31.0 * 31.0 / mse);
+}
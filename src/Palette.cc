@@ -0,0 +1,193 @@
+#include <FlicTool/Palette.h>
+
+#include <FlicTool/FrameHash.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	const uint32_t colorCount = 1 << 15;
+	const int kmeansRounds = 4;
+
+	inline int channel(uint32_t color, int c) {
+		return (color >> (c * 5)) & 0x1f;
+	}
+
+	inline uint32_t distance(uint32_t a, uint32_t b) {
+		uint32_t d = 0;
+		for (int c = 0; c < 3; ++c) {
+			int delta = channel(a, c) - channel(b, c);
+			d += delta * delta;
+		}
+		return d;
+	}
+
+	struct WeightedColor {
+		uint16_t color;
+		uint64_t weight;
+	};
+
+	/**
+	 * A box of colors for median cut, a range of the colors being split.
+	 */
+	struct Box {
+		size_t begin;
+		size_t end;
+		int axis;
+		int range;
+	};
+
+	void measure(const std::vector<WeightedColor> &colors, Box &box) {
+		int low[3] = { 31, 31, 31 }, high[3] = { 0, 0, 0 };
+		for (size_t i = box.begin; i < box.end; ++i) {
+			for (int c = 0; c < 3; ++c) {
+				low[c] = std::min(low[c], channel(colors[i].color, c));
+				high[c] = std::max(high[c], channel(colors[i].color, c));
+			}
+		}
+		box.axis = 0;
+		for (int c = 1; c < 3; ++c) {
+			if (high[c] - low[c] > high[box.axis] - low[box.axis]) {
+				box.axis = c;
+			}
+		}
+		box.range = high[box.axis] - low[box.axis];
+	}
+
+	uint16_t mean(const std::vector<WeightedColor> &colors, size_t begin, size_t end) {
+		uint64_t sum[3] = { 0, 0, 0 }, weight = 0;
+		for (size_t i = begin; i < end; ++i) {
+			for (int c = 0; c < 3; ++c) {
+				sum[c] += channel(colors[i].color, c) * colors[i].weight;
+			}
+			weight += colors[i].weight;
+		}
+		uint16_t color = 0;
+		for (int c = 0; c < 3; ++c) {
+			color |= static_cast<uint16_t>((sum[c] + weight / 2) / weight) << (c * 5);
+		}
+		return color;
+	}
+}
+
+Palette::Palette() : histogram_(colorCount, 0) {
+}
+
+void Palette::addPixels(const uint8_t *pixels, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		uint16_t pixel;
+		memcpy(&pixel, pixels + i * 2, 2);
+		++histogram_[pixel & 0x7fff];
+	}
+}
+
+void Palette::build(uint32_t maxColors) {
+	maxColors = std::max(1u, std::min(maxColors, 256u));
+	std::vector<WeightedColor> colors;
+	for (uint32_t color = 0; color < colorCount; ++color) {
+		if (histogram_[color] > 0) {
+			colors.push_back(WeightedColor { static_cast<uint16_t>(color), histogram_[color] });
+		}
+	}
+
+	colors_.clear();
+	if (colors.size() <= maxColors) {
+		for (const WeightedColor &color : colors) {
+			colors_.push_back(color.color);
+		}
+	} else {
+		// Median cut: keep splitting the box with the widest range of
+		// colors at the median of its widest channel
+		std::vector<Box> boxes(1, Box { 0, colors.size(), 0, 0 });
+		measure(colors, boxes[0]);
+		while (boxes.size() < maxColors) {
+			auto widest = std::max_element(boxes.begin(), boxes.end(), [](const Box &a, const Box &b) { return a.range < b.range; });
+			if (widest->range == 0) {
+				break;
+			}
+			Box box = *widest;
+			int axis = box.axis;
+			std::sort(colors.begin() + box.begin, colors.begin() + box.end, [axis](const WeightedColor &a, const WeightedColor &b) {
+				return channel(a.color, axis) < channel(b.color, axis);
+			});
+			uint64_t total = 0;
+			for (size_t i = box.begin; i < box.end; ++i) {
+				total += colors[i].weight;
+			}
+			// Both halves get at least one color
+			size_t split = box.begin + 1;
+			uint64_t below = colors[box.begin].weight;
+			while (split < box.end - 1 && below * 2 < total) {
+				below += colors[split++].weight;
+			}
+			Box first = { box.begin, split, 0, 0 }, second = { split, box.end, 0, 0 };
+			measure(colors, first);
+			measure(colors, second);
+			*widest = first;
+			boxes.push_back(second);
+		}
+		for (const Box &box : boxes) {
+			colors_.push_back(mean(colors, box.begin, box.end));
+		}
+
+		// k-means: move every palette color to the middle of the colors
+		// nearest to it, which evens out the error median cut leaves
+		for (int round = 0; round < kmeansRounds; ++round) {
+			std::vector<uint64_t> sums(colors_.size() * 4, 0);
+			for (size_t i = 0; i < colors.size(); ++i) {
+				uint8_t index = nearest(colors[i].color);
+				for (int c = 0; c < 3; ++c) {
+					sums[index * 4 + c] += channel(colors[i].color, c) * colors[i].weight;
+				}
+				sums[index * 4 + 3] += colors[i].weight;
+			}
+			for (size_t p = 0; p < colors_.size(); ++p) {
+				uint64_t weight = sums[p * 4 + 3];
+				if (weight == 0) {
+					continue;
+				}
+				uint16_t color = 0;
+				for (int c = 0; c < 3; ++c) {
+					color |= static_cast<uint16_t>((sums[p * 4 + c] + weight / 2) / weight) << (c * 5);
+				}
+				colors_[p] = color;
+			}
+		}
+	}
+
+	// Only the colors that appear in the frames are looked up in advance
+	lookup_.assign(colorCount, 0);
+	for (const WeightedColor &color : colors) {
+		lookup_[color.color] = nearest(color.color);
+	}
+}
+
+const std::vector<uint16_t> &Palette::colors() const {
+	return colors_;
+}
+
+void Palette::map(const uint8_t *pixels, uint8_t *indices, size_t count) const {
+	for (size_t i = 0; i < count; ++i) {
+		uint16_t pixel;
+		memcpy(&pixel, pixels + i * 2, 2);
+		pixel &= 0x7fff;
+		indices[i] = histogram_[pixel] > 0 ? lookup_[pixel] : nearest(pixel);
+	}
+}
+
+uint64_t Palette::hash() const {
+	return hashBytes(reinterpret_cast<const uint8_t*>(colors_.data()), colors_.size() * sizeof(uint16_t));
+}
+
+uint8_t Palette::nearest(uint16_t color) const {
+	uint8_t best = 0;
+	uint32_t bestDistance = UINT32_MAX;
+	for (size_t i = 0; i < colors_.size() && bestDistance > 0; ++i) {
+		uint32_t d = distance(color, colors_[i]);
+		if (d < bestDistance) {
+			bestDistance = d;
+			best = static_cast<uint8_t>(i);
+		}
+	}
+	return best;
+}
@@ -0,0 +1,178 @@
+#include <FlicTool/PixelConvert.h>
+
+// See LineDiff.cc for why the kernels are compiled this way
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FLICTOOL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+	/**
+	 * Thresholds of a 4x4 ordered dither, added to a channel scaled by 31
+	 * before dividing it by 255. Without dithering, every pixel gets the
+	 * threshold in the middle, which rounds to the nearest value.
+	 */
+	const uint16_t ditherThresholds[4][4] = {
+		{   8, 136,  40, 168 },
+		{ 200,  72, 232, 104 },
+		{  56, 184,  24, 152 },
+		{ 248, 120, 216,  88 }
+	};
+	const uint16_t roundingThreshold = 127;
+
+	/**
+	 * Reduces an 8-bit channel to 5 bits. The result is the same as the
+	 * rounded floating point division the conversion used to do.
+	 */
+	inline uint16_t reduceChannel(uint32_t c, uint32_t threshold) {
+		return static_cast<uint16_t>((c * 31 + threshold) / 255);
+	}
+
+	/**
+	 * A kernel converts as many pixels of a standard layout as it can in
+	 * whole vectors and returns the number of pixels it has handled. The
+	 * rest of the line is left to the caller.
+	 */
+	typedef uint32_t (*ConvertKernel)(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t stride, const uint16_t *thresholds);
+
+	uint32_t convertScalar(const uint8_t *, uint16_t *, uint32_t, uint32_t, const uint16_t *) {
+		return 0;
+	}
+
+#ifdef FLICTOOL_X86_KERNELS
+	__attribute__((target("ssse3")))
+	uint32_t convertSsse3(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t stride, const uint16_t *thresholds) {
+		// Every shuffle spreads one channel of four pixels out to 16-bit
+		// lanes, in the low half for the first four pixels of a block and in
+		// the high half for the other four
+		const int8_t z = -128;
+		const int8_t s = static_cast<int8_t>(stride);
+		__m128i lowMasks[3], highMasks[3];
+		for (int8_t c = 0; c < 3; ++c) {
+			lowMasks[c] = _mm_setr_epi8(c, z, c + s, z, c + 2 * s, z, c + 3 * s, z, z, z, z, z, z, z, z, z);
+			highMasks[c] = _mm_setr_epi8(z, z, z, z, z, z, z, z, c, z, c + s, z, c + 2 * s, z, c + 3 * s, z);
+		}
+		// The blocks start at multiples of 8, so the thresholds of the first
+		// four pixels of the line apply to every half of every block
+		__m128i threshold = _mm_setr_epi16(thresholds[0], thresholds[1], thresholds[2], thresholds[3],
+			thresholds[0], thresholds[1], thresholds[2], thresholds[3]);
+		const __m128i scale = _mm_set1_epi16(31);
+		// Dividing by 255 is the same as multiplying by 0x8081 and shifting
+		// by 23 for everything a channel can reach here
+		const __m128i reciprocal = _mm_set1_epi16(static_cast<int16_t>(0x8081));
+
+		uint32_t x = 0;
+		// Every block reads 16 bytes from the start of its fifth pixel, which
+		// goes past the end of the line for 24-bit pixels
+		for (; (x + 4) * stride + 16 <= width * stride; x += 8) {
+			__m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * stride));
+			__m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + (x + 4) * stride));
+			__m128i pixels = _mm_setzero_si128();
+			for (int c = 0; c < 3; ++c) {
+				__m128i channel = _mm_or_si128(_mm_shuffle_epi8(first, lowMasks[c]), _mm_shuffle_epi8(second, highMasks[c]));
+				channel = _mm_add_epi16(_mm_mullo_epi16(channel, scale), threshold);
+				channel = _mm_srli_epi16(_mm_mulhi_epu16(channel, reciprocal), 7);
+				pixels = _mm_or_si128(pixels, _mm_slli_epi16(channel, c * 5));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), pixels);
+		}
+		return x;
+	}
+#endif
+
+	struct KernelChoice {
+		ConvertKernel kernel;
+		const char *name;
+	};
+
+	KernelChoice selectKernel() {
+		KernelChoice choice = { convertScalar, "scalar" };
+#ifdef FLICTOOL_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("ssse3")) {
+			choice.kernel = convertSsse3;
+			choice.name = "ssse3";
+		}
+#endif
+		return choice;
+	}
+
+	const KernelChoice &kernel() {
+		static const KernelChoice choice = selectKernel();
+		return choice;
+	}
+}
+
+PixelConverter::PixelConverter(uint32_t bpp, const uint32_t *bitMask, bool dither) : stride_(bpp / 8), dither_(dither) {
+	standard_ = (bpp == 24 || bpp == 32) && bitMask[0] == 0xff && bitMask[1] == 0xff00 && bitMask[2] == 0xff0000;
+
+	for (int j = 0; j < 3; ++j) {
+		uint32_t mask = bitMask[j];
+		uint32_t shift = 0;
+		if (mask != 0) {
+			for (uint32_t p = mask; (p & 1) == 0; p >>= 1) ++shift;
+		}
+		// Channels wider than 16 bits lose their lowest bits, which keeps
+		// the tables small and can't change the result by more than rounding
+		while ((mask >> shift) > 0xffff) ++shift;
+		bitMask_[j] = mask;
+		bitShift_[j] = shift;
+		if (standard_) continue;
+
+		uint32_t max = mask >> shift;
+		std::vector<uint16_t> &table = tables_[j];
+		table.resize(max + 1);
+		for (uint32_t c = 0; c <= max && max > 0; ++c) {
+			if (dither_) {
+				table[c] = static_cast<uint16_t>(static_cast<float>(c) / max * 255 + 0.5f);
+			} else {
+				int value = static_cast<int>(static_cast<float>(c) / max * 31 + 0.5f);
+				table[c] = static_cast<uint16_t>((value & 0x1f) << (j * 5));
+			}
+		}
+	}
+}
+
+void PixelConverter::convertLine(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t y) const {
+	if (standard_) {
+		const uint16_t *thresholds = dither_ ? ditherThresholds[y % 4] : nullptr;
+		uint16_t rounding[4] = { roundingThreshold, roundingThreshold, roundingThreshold, roundingThreshold };
+		uint32_t x = kernel().kernel(source, target, width, stride_, thresholds ? thresholds : rounding);
+		convertStandard(source, target, x, width, y);
+	} else {
+		convertMasked(source, target, width, y);
+	}
+}
+
+const char *PixelConverter::kernelName() const {
+	return standard_ ? kernel().name : "lookup";
+}
+
+void PixelConverter::convertStandard(const uint8_t *source, uint16_t *target, uint32_t from, uint32_t width, uint32_t y) const {
+	for (uint32_t x = from; x < width; ++x) {
+		const uint8_t *pixel = source + x * stride_;
+		uint32_t threshold = dither_ ? ditherThresholds[y % 4][x % 4] : roundingThreshold;
+		target[x] = reduceChannel(pixel[0], threshold)
+			| (reduceChannel(pixel[1], threshold) << 5)
+			| (reduceChannel(pixel[2], threshold) << 10);
+	}
+}
+
+void PixelConverter::convertMasked(const uint8_t *source, uint16_t *target, uint32_t width, uint32_t y) const {
+	for (uint32_t x = 0; x < width; ++x) {
+		// Only the bytes of the pixel itself are read, so the last pixel of
+		// the line doesn't read past its end
+		const uint8_t *p = source + x * stride_;
+		uint32_t pixel = 0;
+		for (uint32_t i = 0; i < stride_; ++i) {
+			pixel |= static_cast<uint32_t>(p[i]) << (i * 8);
+		}
+		uint16_t result = 0;
+		for (int j = 0; j < 3; ++j) {
+			uint16_t value = tables_[j][(pixel & bitMask_[j]) >> bitShift_[j]];
+			result |= dither_ ? reduceChannel(value, ditherThresholds[y % 4][x % 4]) << (j * 5) : value;
+		}
+		target[x] = result;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <FlicTool/Stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+	// Each thread counts its own allocations. The shared count is only kept
+	// once a report needs it, so that threads don't fight over it otherwise
+	std::atomic<bool> countingTotal(false);
+	std::atomic<uint64_t> allocations(0);
+	thread_local uint64_t allocationsOnThread = 0;
+
+	const char *stageNames[] = {
+		"scan", "load", "downsample", "filter", "hash", "diff", "packetize", "write", "decode", "save"
+	};
+
+	std::string quote(const std::string &s) {
+		std::ostringstream os;
+		os << '"';
+		for (char c : s) {
+			switch (c) {
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\r': os << "\\r"; break;
+			case '\t': os << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+				} else {
+					os << c;
+				}
+			}
+		}
+		os << '"';
+		return os.str();
+	}
+
+	std::string chunkName(uint16_t type) {
+		switch (type) {
+		case 11: return "\"FLI_COLOR\"";
+		case 12: return "\"FLI_LC\"";
+		case 15: return "\"FLI_BRUN\"";
+		case 16: return "\"FLI_COPY\"";
+		case 25: return "\"DTA_BRUN\"";
+		case 26: return "\"DTA_COPY\"";
+		case 27: return "\"DTA_LC\"";
+		case 0: return "null";
+		default: return std::to_string(type);
+		}
+	}
+}
+
+Stats::Stats(const std::string &operation, const std::string &input, const std::string &output)
+	: operation_(operation), input_(input), output_(output), start_(Clock::now()), startAllocations_(0),
+	frames_(0), width_(0), height_(0), depth_(0), psnr_(std::numeric_limits<double>::quiet_NaN()) {
+	countTotalAllocations();
+	startAllocations_ = totalAllocations();
+	for (int i = 0; i < static_cast<int>(Stage::Count); ++i) {
+		stageNanoseconds_[i] = 0;
+		stageCalls_[i] = 0;
+	}
+}
+
+Stats::Clock::time_point Stats::record(Stage stage, Clock::time_point start) {
+	Clock::time_point now = Clock::now();
+	add(stage, now - start);
+	return now;
+}
+
+void Stats::add(Stage stage, Clock::duration duration, uint64_t calls) {
+	stageNanoseconds_[static_cast<int>(stage)] += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	stageCalls_[static_cast<int>(stage)] += calls;
+}
+
+void Stats::addFrame(const FrameStats &frame) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	frameStats_.push_back(frame);
+}
+
+void Stats::setAnimation(uint32_t frames, uint32_t width, uint32_t height, uint32_t depth) {
+	frames_ = frames;
+	width_ = width;
+	height_ = height;
+	depth_ = depth;
+}
+
+void Stats::setPsnr(double psnr) {
+	psnr_ = psnr;
+}
+
+void Stats::writeJson(std::ostream &os, bool success) {
+	double seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::sort(frameStats_.begin(), frameStats_.end(), [](const FrameStats &a, const FrameStats &b) { return a.index < b.index; });
+	uint64_t frameSize = static_cast<uint64_t>(width_) * height_ * (depth_ / 8);
+	uint64_t totalBytes = 0;
+	for (const FrameStats &frame : frameStats_) {
+		totalBytes += frame.bytes;
+	}
+
+	os << "{\n";
+	os << "  \"operation\": " << quote(operation_) << ",\n";
+	os << "  \"input\": " << quote(input_) << ",\n";
+	os << "  \"output\": " << quote(output_) << ",\n";
+	os << "  \"success\": " << (success ? "true" : "false") << ",\n";
+	os << "  \"frames\": " << frames_ << ",\n";
+	os << "  \"width\": " << width_ << ",\n";
+	os << "  \"height\": " << height_ << ",\n";
+	os << "  \"depth\": " << depth_ << ",\n";
+	os << "  \"seconds\": " << seconds << ",\n";
+	os << "  \"allocations\": " << (totalAllocations() - startAllocations_) << ",\n";
+	os << "  \"peakResidentBytes\": " << peakResidentBytes() << ",\n";
+	os << "  \"pixelBytes\": " << frameSize * frameStats_.size() << ",\n";
+	os << "  \"chunkBytes\": " << totalBytes << ",\n";
+	os << "  \"compressionRatio\": " << (totalBytes > 0 ? static_cast<double>(frameSize * frameStats_.size()) / totalBytes : 0.0) << ",\n";
+	// Lossless compiles have no PSNR, and JSON has no infinity for frames
+	// that were stored exactly after all
+	os << "  \"psnr\": ";
+	if (std::isfinite(psnr_)) {
+		os << psnr_ << ",\n";
+	} else {
+		os << "null,\n";
+	}
+	os << "  \"stages\": {\n";
+	for (int i = 0; i < static_cast<int>(Stage::Count); ++i) {
+		os << "    \"" << stageNames[i] << "\": { \"seconds\": " << stageNanoseconds_[i] / 1e9 << ", \"calls\": " << stageCalls_[i] << " }"
+			<< (i + 1 < static_cast<int>(Stage::Count) ? ",\n" : "\n");
+	}
+	os << "  },\n";
+	os << "  \"frameStats\": [";
+	for (size_t i = 0; i < frameStats_.size(); ++i) {
+		const FrameStats &frame = frameStats_[i];
+		os << (i > 0 ? ",\n" : "\n");
+		os << "    { \"index\": " << frame.index
+			<< ", \"chunk\": " << chunkName(frame.chunkType)
+			<< ", \"encoding\": " << quote(frame.encoding)
+			<< ", \"bytes\": " << frame.bytes
+			<< ", \"packets\": ";
+		if (frame.packets < 0) {
+			os << "null";
+		} else {
+			os << frame.packets;
+		}
+		os << ", \"compressionRatio\": " << (frame.bytes > 0 ? static_cast<double>(frameSize) / frame.bytes : 0.0)
+			<< ", \"allocations\": " << frame.allocations
+			<< ", \"seconds\": " << frame.seconds << " }";
+	}
+	os << (frameStats_.empty() ? "]\n" : "\n  ]\n");
+	os << "}\n";
+}
+
+void countAllocation() {
+	++allocationsOnThread;
+	if (countingTotal.load(std::memory_order_relaxed)) {
+		allocations.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void countTotalAllocations() {
+	countingTotal = true;
+}
+
+uint64_t threadAllocations() {
+	return allocationsOnThread;
+}
+
+uint64_t totalAllocations() {
+	return allocations;
+}
+
+uint64_t peakResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	// Linux and the BSDs count in kilobytes
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,279 @@
+/*****************************************************************************
+ * Flic Tool Benchmark
+ *  Times the encoding and decoding kernels of FlicTool on synthetic frames.
+ *****************************************************************************/
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <FlicTool/Bitmap.h>
+#include <FlicTool/ByteCursor.h>
+#include <FlicTool/Flic.h>
+#include <FlicTool/FrameHash.h>
+#include <FlicTool/LineDiff.h>
+#include <FlicTool/PixelConvert.h>
+#include <FlicTool/Stats.h>
+
+#include "ChunkDecoder.h"
+#include "ChunkEncoder.h"
+
+namespace po = boost::program_options;
+
+/**
+ * A frame of 16-bit pixels, stored bottom-up like a bitmap.
+ */
+struct Frame {
+	std::string name;
+	std::vector<uint8_t> pixels;
+};
+
+/**
+ * Runs the chunk kernels the library uses internally on synthetic frames.
+ */
+class Benchmark {
+public:
+	Benchmark(uint32_t width, uint32_t height, double minTime) : width_(width), height_(height), minTime_(minTime) {
+		header_ = FlicHeader();
+		header_.width = width;
+		header_.height = height;
+		header_.depth = 16;
+	}
+
+	/**
+	 * Runs every kernel on every kind of frame and prints the results.
+	 */
+	void run() {
+		Frame flat = makeFrame("flat", [](uint32_t, uint32_t, std::mt19937&) { return uint16_t(0x1234); });
+		Frame gradient = makeFrame("gradient", [this](uint32_t x, uint32_t y, std::mt19937&) {
+			return uint16_t(((x * 32 / width_) << 10) | ((y * 32 / height_) << 5) | ((x + y) / 16 % 32));
+		});
+		Frame noise = makeFrame("noise", [](uint32_t, uint32_t, std::mt19937 &random) { return uint16_t(random() & 0x7fff); });
+		// Small clusters of changed pixels on top of the gradient, the way
+		// sprites move over a static background
+		Frame sparse = gradient;
+		sparse.name = "sparse";
+		std::mt19937 random(2);
+		for (uint32_t i = 0; i < width_ * height_ / 400; ++i) {
+			uint32_t x = random() % width_, y = random() % height_;
+			for (uint32_t n = 0; n < 8 && x + n < width_; ++n) {
+				reinterpret_cast<uint16_t*>(sparse.pixels.data())[y * width_ + x + n] = uint16_t(random() & 0x7fff);
+			}
+		}
+
+		FrameHash hash;
+		std::cout << "Frames of " << width_ << "x" << height_ << ", diff kernel: " << diffKernelName() << "\n\n";
+		std::cout << std::left << std::setw(32) << "kernel" << std::right << std::setw(12) << "MB/s" << std::setw(12) << "pixels/ns" << std::setw(16) << "allocs/frame" << "\n";
+		for (const Frame *frame : { &flat, &gradient, &noise }) {
+			benchmarkKeyframe(*frame);
+		}
+		benchmarkDelta(gradient, sparse);
+		benchmarkDelta(gradient, noise);
+		measure("hashFrame/" + gradient.name, gradient.pixels.size(), [&]() {
+			hashFrame(gradient.pixels.data(), width_, height_, 2, hash);
+		});
+		benchmarkDownsample(24, false);
+		benchmarkDownsample(32, false);
+		benchmarkDownsample(32, true);
+	}
+private:
+	Frame makeFrame(const std::string &name, const std::function<uint16_t(uint32_t, uint32_t, std::mt19937&)> &pixel) {
+		Frame frame;
+		frame.name = name;
+		frame.pixels.resize(width_ * height_ * 2);
+		std::mt19937 random(1);
+		uint16_t *p = reinterpret_cast<uint16_t*>(frame.pixels.data());
+		for (uint32_t y = 0; y < height_; ++y) {
+			for (uint32_t x = 0; x < width_; ++x) {
+				p[y * width_ + x] = pixel(x, y, random);
+			}
+		}
+		return frame;
+	}
+
+	/**
+	 * Calls a function that processes one frame until the minimum time has passed, and prints its throughput.
+	 * \param name the name of the kernel and input
+	 * \param bytes the number of input bytes the function processes per call
+	 * \param frame the function to time
+	 */
+	void measure(const std::string &name, size_t bytes, const std::function<void()> &frame) {
+		// One untimed call warms up caches and the scratch buffers the kernels reuse
+		frame();
+		typedef std::chrono::steady_clock Clock;
+		uint64_t iterations = 0;
+		uint64_t startAllocations = threadAllocations();
+		Clock::time_point start = Clock::now();
+		double elapsed = 0;
+		do {
+			frame();
+			++iterations;
+			elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		} while (elapsed < minTime_);
+		double allocsPerFrame = double(threadAllocations() - startAllocations) / iterations;
+		double seconds = elapsed / iterations;
+		std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+			<< std::setw(12) << std::setprecision(1) << bytes / seconds / 1e6
+			<< std::setw(12) << std::setprecision(3) << width_ * height_ / seconds / 1e9
+			<< std::setw(16) << std::setprecision(1) << allocsPerFrame << "\n";
+	}
+
+	void benchmarkKeyframe(const Frame &frame) {
+		const uint8_t *pixels = frame.pixels.data();
+		size_t pitch = width_ * 2;
+		size_t words = maskWords(width_);
+		std::vector<uint64_t> same(words * height_);
+		std::vector<uint8_t> buffer;
+		buffer.reserve(frame.pixels.size() * 2);
+
+		measure("diffLine/" + frame.name, frame.pixels.size(), [&]() {
+			for (uint32_t y = 0; y < height_; ++y) {
+				diffLine(pixels + y * pitch, nullptr, width_, 2, nullptr, &same[y * words]);
+			}
+		});
+		measure("encodeRle/" + frame.name, frame.pixels.size(), [&]() {
+			buffer.clear();
+			for (uint32_t y = 0; y < height_; ++y) {
+				encodeRle(pixels + y * pitch, &same[y * words], width_, 2, buffer);
+			}
+		});
+		measure("encodeLineOptimal/" + frame.name, frame.pixels.size(), [&]() {
+			buffer.clear();
+			for (uint32_t y = 0; y < height_; ++y) {
+				encodeLineOptimal(pixels + y * pitch, nullptr, &same[y * words], width_, 2, buffer);
+			}
+		});
+
+		Bitmap bmp(sharePixels(frame), width_, height_, 16);
+		CompileOptions options;
+		buffer.clear();
+		createBrun(header_, bmp, options, buffer);
+		std::vector<uint8_t> decoded(frame.pixels.size());
+		measure("readBrun/" + frame.name, frame.pixels.size(), [&]() {
+			ByteCursor cursor = chunkCursor(buffer);
+			readBrun(cursor, header_, decoded.data());
+		});
+	}
+
+	void benchmarkDelta(const Frame &previous, const Frame &frame) {
+		const uint8_t *pixels = frame.pixels.data();
+		const uint8_t *oldPixels = previous.pixels.data();
+		size_t pitch = width_ * 2;
+		size_t words = maskWords(width_);
+		std::vector<uint64_t> changed(words * height_), same(words * height_);
+		std::vector<uint8_t> buffer;
+		buffer.reserve(frame.pixels.size() * 2);
+		std::vector<SubChunk> subChunks;
+		subChunks.reserve(width_);
+		std::string name = previous.name + ">" + frame.name;
+
+		measure("diffLine/" + name, frame.pixels.size() * 2, [&]() {
+			for (uint32_t y = 0; y < height_; ++y) {
+				diffLine(pixels + y * pitch, oldPixels + y * pitch, width_, 2, &changed[y * words], &same[y * words]);
+			}
+		});
+		measure("getSubChunks/" + name, frame.pixels.size(), [&]() {
+			for (uint32_t y = 0; y < height_; ++y) {
+				subChunks.clear();
+				getSubChunks(pixels + y * pitch, &changed[y * words], width_, 2, subChunks);
+			}
+		});
+		measure("encodeDeltaRle/" + name, frame.pixels.size(), [&]() {
+			buffer.clear();
+			for (uint32_t y = 0; y < height_; ++y) {
+				subChunks.clear();
+				getSubChunks(pixels + y * pitch, &changed[y * words], width_, 2, subChunks);
+				encodeDeltaRle(subChunks, &same[y * words], 2, buffer);
+			}
+		});
+		measure("encodeLineOptimal/" + name, frame.pixels.size(), [&]() {
+			buffer.clear();
+			for (uint32_t y = 0; y < height_; ++y) {
+				encodeLineOptimal(pixels + y * pitch, &changed[y * words], &same[y * words], width_, 2, buffer);
+			}
+		});
+
+		// Without hashes, every line is diffed
+		SourceFrame oldSource, source;
+		oldSource.bitmap.create(sharePixels(previous), width_, height_, 16);
+		source.bitmap.create(sharePixels(frame), width_, height_, 16);
+		CompileOptions options;
+		buffer.clear();
+		createLc(header_, oldSource, source, options, buffer);
+		std::vector<uint8_t> decoded(frame.pixels.size());
+		measure("readLc/" + name, frame.pixels.size(), [&]() {
+			ByteCursor cursor = chunkCursor(buffer);
+			readLc(cursor, header_, decoded.data());
+		});
+	}
+
+	void benchmarkDownsample(uint32_t bpp, bool dither) {
+		std::vector<uint8_t> original(width_ * height_ * (bpp / 8));
+		std::mt19937 random(3);
+		for (auto &c : original) {
+			c = uint8_t(random());
+		}
+		// Blue, green, red and alpha, the layout of every 24-bit and 32-bit
+		// BI_RGB bitmap
+		uint32_t bitMask[4] = { 0xff, 0xff00, 0xff0000, 0 };
+		PixelConverter converter(bpp, bitMask, dither);
+		std::vector<uint16_t> converted(width_ * height_);
+		uint32_t pitch = width_ * (bpp / 8);
+		std::string name = "downsample/" + std::to_string(bpp) + "/" + converter.kernelName() + (dither ? "/dither" : "");
+		measure(name, original.size(), [&]() {
+			for (uint32_t y = 0; y < height_; ++y) {
+				converter.convertLine(original.data() + y * pitch, converted.data() + y * width_, width_, y);
+			}
+		});
+	}
+
+	std::shared_ptr<uint8_t> sharePixels(const Frame &frame) {
+		return std::shared_ptr<uint8_t>(const_cast<uint8_t*>(frame.pixels.data()), [](uint8_t*) {});
+	}
+
+	ByteCursor chunkCursor(const std::vector<uint8_t> &frame) {
+		size_t offset = sizeof(FlicFrameHeader) + sizeof(FlicChunkHeader);
+		return ByteCursor(frame.data() + offset, frame.size() - offset);
+	}
+
+	uint32_t width_;
+	uint32_t height_;
+	double minTime_;
+	FlicHeader header_;
+};
+
+int main(int argc, char **argv) {
+	po::options_description desc;
+	uint32_t width, height;
+	double minTime;
+	desc.add_options()
+		("help", "show program help")
+		("width,w", po::value<uint32_t>(&width)->default_value(640), "width of the synthetic frames")
+		("height,h", po::value<uint32_t>(&height)->default_value(480), "height of the synthetic frames")
+		("time,t", po::value<double>(&minTime)->default_value(0.5), "minimum number of seconds to run each kernel for")
+	;
+	po::variables_map vm;
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+	} catch (po::error &e) {
+		std::cerr << "Error: " << e.what() << "\n" << desc;
+		return 1;
+	}
+	po::notify(vm);
+	if (vm.count("help") || width == 0 || height == 0) {
+		std::cout << "FlicTool Benchmark\n\n" << desc;
+		return vm.count("help") ? 0 : 1;
+	}
+
+	Benchmark benchmark(width, height, minTime);
+	benchmark.run();
+	return 0;
+}
\ No newline at end of file
@@ -5,14 +5,18 @@
  *    (http://www.rockraidersunited.org/user/4758-merigrim/)
  *****************************************************************************/
 
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 
+#include <FlicTool/Batch.h>
 #include <FlicTool/Flic.h>
+#include <FlicTool/Stats.h>
 
 #define FLICTOOL_VERSION "1.1"
 
@@ -35,11 +39,36 @@ bool prompt() {
 
 int main(int argc, char **argv) {
 	po::options_description desc;
-	std::string input, output;
+	std::string input, output, manifest, scanRoot, overwrite, statsPath, format;
+	uint32_t jobs;
+	bool adaptive, playNull, optimize;
+	CompileOptions compileOptions;
+	DecompileOptions decompileOptions;
+	PlayOptions playOptions;
 	desc.add_options()
 		("help", "show program help")
 		("input,i", po::value<std::string>(&input), "input path to either a Flic file to decompile or a directory of bitmaps to compile")
-		("output,o", po::value<std::string>(&output)->default_value(""), "output path to either the compiled Flic file or a directory to put decompiled frames in")
+		("output,o", po::value<std::string>(&output)->default_value(""), "output path to either the compiled Flic file (- for standard output) or a directory to put decompiled frames in")
+		("jobs,j", po::value<uint32_t>(&jobs)->default_value(1), "number of threads to encode frames with when compiling or to save frames with when decompiling, or the number of jobs to run at once in batch mode (0 to use all cores, the default in batch mode)")
+		("loaders", po::value<uint32_t>(&compileOptions.loaders)->default_value(1), "when compiling, number of threads to load and convert frames on ahead of the encoder (0 to use all cores)")
+		("prefetch", po::value<uint32_t>(&compileOptions.prefetch)->default_value(0), "when compiling, the most frames to load ahead of the encoder (0 for twice the number of loader threads)")
+		("batch", po::value<std::string>(&manifest), "run the jobs listed in a manifest file, one input path per line, optionally followed by a tab and an output path")
+		("scan", po::value<std::string>(&scanRoot), "run a compile job for every folder of frames and a decompile job for every FLH file in a directory tree")
+		("overwrite", po::value<std::string>(&overwrite)->default_value("skip"), "what batch jobs do when their output already exists: skip, overwrite or fail")
+		("keyframes,k", po::value<uint32_t>(&compileOptions.keyframeInterval)->default_value(0), "when compiling, insert a keyframe every N frames to allow decoding frames without decoding the whole animation (0 for none)")
+		("frame,f", po::value<uint32_t>(&decompileOptions.frame)->default_value(0), "when decompiling, only extract the frame with the specified number, starting at 1")
+		("format", po::value<std::string>(&format)->default_value("bmp"), "when decompiling, write every frame as a bitmap file (bmp), or all frames to a single file of raw pixels (rgb555 or rgb24), which can be - for standard output")
+		("stream-header", po::bool_switch(&decompileOptions.streamHeader), "when decompiling to raw pixels, start the file with a header giving the pixel format, dimensions, frame count and speed")
+		("adaptive", po::bool_switch(&adaptive), "when compiling, store every frame as whichever of a DTA_LC delta, a DTA_BRUN frame or an uncompressed DTA_COPY frame is smallest, instead of only making keyframes DTA_BRUN frames and the rest DTA_LC deltas")
+		("optimal", po::bool_switch(&compileOptions.optimal), "when compiling, search for the smallest encoding of every line instead of using the faster greedy encoder")
+		("dither", po::bool_switch(&compileOptions.dither), "when compiling, convert 24-bit and 32-bit frames to 16 bits with an ordered dither instead of rounding every pixel to the nearest color")
+		("palettized", po::bool_switch(&compileOptions.palettized), "when compiling, store the animation as 8-bit pixels with a palette of up to 256 colors built from every frame")
+		("tolerance", po::value<uint32_t>(&compileOptions.tolerance)->default_value(0), "when compiling, leave pixels unchanged while every 5-bit channel is within this distance of the previous frame, from 0 for lossless up to 31")
+		("cache", po::value<std::string>(&compileOptions.cacheDirectory), "when compiling, keep encoded frames in a directory and reuse them for frames that haven't changed since the last compile (entries are never removed, so the directory grows until it is deleted)")
+		("optimize", po::bool_switch(&optimize), "re-encode a Flic file with the current encoder and the compile options, decoding its frames in memory instead of going through bitmap files")
+		("play-null", po::bool_switch(&playNull), "decode a Flic file as fast as possible without saving any frames, report the frame rate and the slowest frame, and fail if it can't keep up with its speed")
+		("loops", po::value<uint32_t>(&playOptions.loops)->default_value(1), "with --play-null, the number of times to play the animation")
+		("stats", po::value<std::string>(&statsPath), "write the time spent in every stage and the size of every frame to a JSON file, or to standard output if the path is -")
 	;
 	po::positional_options_description pdesc;
 	pdesc.add("input", 1);
@@ -54,6 +83,67 @@ int main(int argc, char **argv) {
 	}
 	po::notify(vm);
 
+	if (compileOptions.tolerance > 31) {
+		std::cerr << "Error: The tolerance has to be between 0 and 31.\n";
+		return 1;
+	}
+	if (format == "bmp") {
+		decompileOptions.format = FrameFormat::Bitmap;
+	} else if (format == "rgb555") {
+		decompileOptions.format = FrameFormat::Rgb555;
+	} else if (format == "rgb24") {
+		decompileOptions.format = FrameFormat::Rgb24;
+	} else {
+		std::cerr << "Error: Invalid frame format \"" << format << "\", expected bmp, rgb555 or rgb24.\n";
+		return 1;
+	}
+	// Raw frames go to a single file instead of a directory of bitmaps
+	bool streaming = decompileOptions.format != FrameFormat::Bitmap;
+
+	if ((vm.count("batch") || vm.count("scan")) && !vm.count("help")) {
+		if (vm.count("stats")) {
+			std::cerr << "Error: --stats can't be used in batch mode.\n";
+			return 1;
+		}
+		if (streaming) {
+			std::cerr << "Error: --format can't be used in batch mode.\n";
+			return 1;
+		}
+		if (optimize) {
+			std::cerr << "Error: --optimize can't be used in batch mode.\n";
+			return 1;
+		}
+		if (playNull || !vm["loops"].defaulted()) {
+			std::cerr << "Error: --play-null and --loops can't be used in batch mode.\n";
+			return 1;
+		}
+		// Batch mode never prompts, since nobody is there to answer
+		BatchOptions batchOptions;
+		if (overwrite == "skip") {
+			batchOptions.overwrite = OverwritePolicy::Skip;
+		} else if (overwrite == "overwrite") {
+			batchOptions.overwrite = OverwritePolicy::Overwrite;
+		} else if (overwrite == "fail") {
+			batchOptions.overwrite = OverwritePolicy::Fail;
+		} else {
+			std::cerr << "Error: Invalid overwrite policy \"" << overwrite << "\", expected skip, overwrite or fail.\n";
+			return 1;
+		}
+		batchOptions.jobs = vm["jobs"].defaulted() ? 0 : jobs;
+		compileOptions.adaptiveChunks = adaptive;
+		batchOptions.compileOptions = compileOptions;
+		batchOptions.decompileOptions = decompileOptions;
+
+		Batch batch;
+		if (vm.count("batch") && !batch.readManifest(manifest)) {
+			return 1;
+		}
+		if (vm.count("scan") && !batch.scan(scanRoot)) {
+			return 1;
+		}
+		return batch.run(batchOptions) ? 0 : 1;
+	}
+
 	// If the user has forgotten to write any arguments or explicitly requested help
 	if (!vm.count("input") || vm.count("help")) {
 		showHelp(desc);
@@ -67,17 +157,58 @@ int main(int argc, char **argv) {
 	}
 
 	bool compiling = fs::is_directory(input);
+
+	if (playNull) {
+		if (compiling) {
+			std::cerr << "Error: --play-null needs a Flic file to play.\n";
+			return 1;
+		}
+		Flic flic;
+		return flic.playNull(input, playOptions) ? 0 : 1;
+	}
+
+	if (optimize) {
+		if (compiling) {
+			std::cerr << "Error: --optimize needs a Flic file to re-encode.\n";
+			return 1;
+		}
+		// Optimizing writes a Flic file, so the output is handled like a
+		// compile from here on
+		compiling = true;
+	}
 	
 	if (output.empty()) {
 		// We need different default output filenames depending on the desired action
 		if (compiling) {
 			output = "output.flh";
+		} else if (streaming) {
+			output = "output.raw";
 		} else {
 			output = "output";
 		}
 	}
 
-	if (fs::exists(output)) {
+	// The input is read from a mapping while the optimized file is written,
+	// so they can't be the same file. This has to be caught before asking
+	// whether to overwrite the output
+	if (optimize && output != "-" && fs::exists(output) && fs::equivalent(input, output)) {
+		std::cerr << "Error: The optimized file can't replace the file it is made from.\n";
+		return 1;
+	}
+
+	if (output == "-") {
+		// Standard output carries the file, so nothing else may be printed to it
+		if (!compiling && !streaming) {
+			std::cerr << "Error: Only compiled Flic files and raw frames can be written to standard output.\n";
+			return 1;
+		}
+		if (statsPath == "-") {
+			std::cerr << "Error: The output and the stats can't both be written to standard output.\n";
+			return 1;
+		}
+		compileOptions.quiet = true;
+		decompileOptions.quiet = true;
+	} else if (fs::exists(output)) {
 		// We need to check if the user is about to accidentally overwrite already existing files
 		if (fs::is_regular_file(output)) {
 			std::cout << "Warning: Output file \"" << output << "\" already exists. Overwrite it? (Y to overwrite, default: no) ";
@@ -98,19 +229,48 @@ int main(int argc, char **argv) {
 				}
 			}
 		}
-	} else if (!compiling) { // If we're decompiling but the output directory doesn't exist, we need to create it
+	} else if (!compiling && !streaming) { // If we're decompiling but the output directory doesn't exist, we need to create it
 		if (!fs::create_directories(output)) {
 			std::cerr << "Error: Unable to create output directory \"" << output << "\". Please make sure that your permissions are set up correctly." << std::endl;
 			return 1;
 		}
 	}
 
+	std::unique_ptr<Stats> stats;
+	if (vm.count("stats")) {
+		stats.reset(new Stats(optimize ? "optimize" : compiling ? "compile" : "decompile", input, output));
+		compileOptions.stats = stats.get();
+		decompileOptions.stats = stats.get();
+		// Keep the progress messages out of the JSON
+		if (statsPath == "-") {
+			compileOptions.quiet = true;
+			decompileOptions.quiet = true;
+		}
+	}
+
 	Flic flic;
+	bool success;
 	if (compiling) {
-		flic.compile(input, output);
+		compileOptions.jobs = jobs;
+		compileOptions.adaptiveChunks = adaptive;
+		success = optimize ? flic.optimize(input, output, compileOptions) : flic.compile(input, output, compileOptions);
 	} else {
-		flic.decompile(input, output);
+		decompileOptions.jobs = jobs;
+		success = flic.decompile(input, output, decompileOptions);
+	}
+
+	if (stats) {
+		if (statsPath == "-") {
+			stats->writeJson(std::cout, success);
+		} else {
+			std::ofstream ofs(statsPath);
+			stats->writeJson(ofs, success);
+			if (!ofs) {
+				std::cerr << "Error: Writing stats file \"" << statsPath << "\" failed.\n";
+				return 1;
+			}
+		}
 	}
 
-	return 0;
+	return success ? 0 : 1;
 }
\ No newline at end of file